@@ -1,6 +1,8 @@
 #pragma once
 
 #include "types.h"
+#include "x86/msr.h"
+#include "x86/atomic.h"
 
 
 namespace x86::apic {
@@ -11,8 +13,201 @@ enum class mode_t {
     x2apic
 };
 
+// Local APIC registers, as offsets from the xAPIC base [SDM 3 10.4.1 "Table 10-1"]
+// in x2APIC mode the register is the msr 0x800 + (offset >> 4) [SDM 3 10.12.1.2 "Table 10-6"]
+enum class register_t : uint16_t {
+    id = 0x20,
+    version = 0x30,
+    tpr = 0x80,
+    apr = 0x90,
+    ppr = 0xa0,
+    eoi = 0xb0,
+    rrd = 0xc0,
+    ldr = 0xd0,
+    dfr = 0xe0,
+    svr = 0xf0,
+    isr0 = 0x100,
+    tmr0 = 0x180,
+    irr0 = 0x200,
+    esr = 0x280,
+    lvt_cmci = 0x2f0,
+    icr_low = 0x300,
+    icr_high = 0x310,
+    lvt_timer = 0x320,
+    lvt_thermal = 0x330,
+    lvt_perfmon = 0x340,
+    lvt_lint0 = 0x350,
+    lvt_lint1 = 0x360,
+    lvt_error = 0x370,
+    timer_initial_count = 0x380,
+    timer_current_count = 0x390,
+    timer_divide_config = 0x3e0,
+    self_ipi = 0x3f0, // x2apic only
+};
+
+// isr/tmr/irr are each 8 32 bit registers, 16 bytes apart
+static constexpr size_t vector_register_stride = 0x10;
+
+static constexpr uint16_t x2apic_msr_base = 0x800;
+
+constexpr uint32_t x2apic_msr(register_t reg) {
+    return x2apic_msr_base + (static_cast<uint16_t>(reg) >> 4);
+}
+
+// [SDM 3 10.6.1 "Figure 10-12"]
+enum class delivery_mode_t : uint8_t {
+    fixed = 0,
+    lowest_priority = 1,
+    smi = 2,
+    nmi = 4,
+    init = 5,
+    startup = 6
+};
+
+enum class destination_mode_t : uint8_t {
+    physical = 0,
+    logical = 1
+};
+
+enum class shorthand_t : uint8_t {
+    none = 0,
+    self = 1,
+    all_including_self = 2,
+    all_excluding_self = 3
+};
+
+#pragma pack(push, 1)
+
+// [SDM 3 10.6.1 "Figure 10-12"] [SDM 3 10.12.9 "Figure 10-28"]
+// in xAPIC mode the destination is only 8 bits, in bits 63:56.
+struct icr_t {
+    union {
+        struct {
+            uint64_t vector : 8;
+            uint64_t delivery_mode : 3;
+            uint64_t destination_mode : 1;
+            uint64_t delivery_status : 1;
+            uint64_t reserved0 : 1;
+            uint64_t level : 1;
+            uint64_t trigger_mode : 1;
+            uint64_t reserved1 : 2;
+            uint64_t shorthand : 2;
+            uint64_t reserved2 : 12;
+            uint64_t destination : 32;
+        } bits;
+        uint64_t raw;
+    };
+};
+static_assert(sizeof(icr_t) == 8, "sizeof(icr_t)");
+
+#pragma pack(pop)
+
+// [SDM 3 10.5.1 "Figure 10-8"]
+static constexpr uint32_t lvt_masked = bit(16);
+static constexpr uint32_t lvt_timer_tsc_deadline = 2 << 17;
+// [SDM 3 10.9 "Figure 10-23"]
+static constexpr uint32_t svr_apic_enable = bit(8);
+
+// Register access for each mode.
+// xAPIC registers are memory mapped (the page is expected to be identity mapped),
+// x2APIC registers are msrs, where the icr is a single 64 bit register and writes are
+// not serializing [SDM 3 10.12.3]. code which knows the mode of the cpu can use these
+// directly, otherwise the functions below select the mode at runtime, from the
+// ia32_apic_base of the current cpu (cpus switch to x2APIC mode one by one).
+
+struct xapic_access_t {
+    static uint32_t read(register_t reg);
+    static void write(register_t reg, uint32_t value);
+    static void write_icr(const icr_t& icr);
+};
+
+struct x2apic_access_t {
+    static uint32_t read(register_t reg) {
+        return static_cast<uint32_t>(msr::read(x2apic_msr(reg)));
+    }
+
+    static void write(register_t reg, uint32_t value) {
+        msr::write(x2apic_msr(reg), value);
+    }
+
+    static void write_icr(const icr_t& icr) {
+        // the wrmsr may pass earlier stores, which the target may need to see
+        atomic::mb();
+        atomic::rmb();
+        msr::write(x2apic_msr(register_t::icr_low), icr.raw);
+    }
+};
+
+template<typename _access>
+inline void eoi() {
+    // [SDM 3 10.8.5] any value, must be 0 in x2APIC mode
+    _access::write(register_t::eoi, 0);
+}
+
+template<typename _access>
+inline void send_ipi(const icr_t& icr) {
+    _access::write_icr(icr);
+}
+
 mode_t current_mode();
 
 bool is_bsp();
 
+// caches the xAPIC base for xapic_access_t. done on first use, call again after moving
+// the base (it must be the same on all the cpus using xapic_access_t).
+void initialize();
+
+// sets the software enable bit and the spurious interrupt vector.
+void enable(uint8_t spurious_vector);
+// switches from xAPIC to x2APIC mode (enabling xAPIC mode first if the apic is
+// disabled), fails if not supported.
+bool enable_x2apic();
+
+// apic id of the current cpu (8 bits in xAPIC mode)
+uint32_t id();
+
+uint32_t read_register(register_t reg);
+void write_register(register_t reg, uint32_t value);
+
+void eoi();
+
+icr_t make_icr(uint8_t vector,
+               delivery_mode_t delivery_mode,
+               uint32_t destination,
+               destination_mode_t destination_mode = destination_mode_t::physical,
+               shorthand_t shorthand = shorthand_t::none);
+void send_ipi(const icr_t& icr);
+
+// fixed interrupt to a single cpu, by its apic id (physical destination mode).
+void send_fixed_ipi(uint32_t destination, uint8_t vector);
+void send_nmi(uint32_t destination);
+void send_init(uint32_t destination);
+// startup ipi, the cpu starts in real mode at page_number << 12
+void send_startup(uint32_t destination, uint8_t page_number);
+// fixed interrupt to all the cpus except this one
+void broadcast_fixed_ipi(uint8_t vector);
+
+// Task priority [SDM 3 10.8.3.1]
+// interrupts with a priority class (vector >> 4) not above the class of the tpr are held.
+uint8_t task_priority();
+void set_task_priority(uint8_t priority);
+
+// CR8 is TPR[7:4], and is faster to write than the register [SDM 3 10.8.6.1].
+static inline uint8_t priority_class() {
+    uintn_t value;
+    asm volatile("mov %%cr8, %0" : "=r"(value));
+    return static_cast<uint8_t>(value);
+}
+
+static inline void set_priority_class(uint8_t priority_class) {
+    asm volatile("mov %0, %%cr8" : : "r"(static_cast<uintn_t>(priority_class)) : "memory");
+}
+
+// TSC-deadline timer [SDM 3 10.5.4.1]
+// the timer fires once the tsc reaches the deadline, it is armed by writing the deadline
+// (0 disarms it). fails if not supported.
+bool enable_deadline_timer(uint8_t vector);
+void set_deadline(uint64_t tsc);
+void cancel_deadline();
+
 }
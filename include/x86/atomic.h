@@ -17,6 +17,11 @@ static inline void rmb() {
     asm volatile("lfence;" : : : "memory");
 }
 
+// spin-wait hint [SDM 2 "PAUSE"]
+static inline void pause() {
+    asm volatile("pause;" : : : "memory");
+}
+
 static inline uint8_t fetchadd8(volatile uint8_t* ptr, uint8_t value) {
     asm volatile("lock xaddb %0, %1"
             : "+r"(value), "+m"(*ptr)
@@ -125,4 +130,36 @@ static inline bool cmpswap64(volatile uint64_t* ptr, uint64_t expect, uint64_t v
     return result;
 }
 
-}
\ No newline at end of file
+static inline void or32(volatile uint32_t* ptr, uint32_t value) {
+    asm volatile("lock orl %1, %0"
+            : "+m"(*ptr)
+            : "r"(value)
+            : "memory", "cc"
+            );
+}
+
+static inline void or64(volatile uint64_t* ptr, uint64_t value) {
+    asm volatile("lock orq %1, %0"
+            : "+m"(*ptr)
+            : "r"(value)
+            : "memory", "cc"
+            );
+}
+
+static inline void and32(volatile uint32_t* ptr, uint32_t value) {
+    asm volatile("lock andl %1, %0"
+            : "+m"(*ptr)
+            : "r"(value)
+            : "memory", "cc"
+            );
+}
+
+static inline void and64(volatile uint64_t* ptr, uint64_t value) {
+    asm volatile("lock andq %1, %0"
+            : "+m"(*ptr)
+            : "r"(value)
+            : "memory", "cc"
+            );
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "x86/common.h"
+
+
+namespace x86 {
+
+// Spinning barrier for a fixed number of cpus (sense reversing, so it can be reused
+// right away for the next rendezvous).
+class barrier_t {
+public:
+    constexpr explicit barrier_t(uint32_t count)
+        : m_count(count)
+        , m_remaining(count)
+        , m_sense(0)
+    {}
+
+    uint32_t count() const;
+
+    // returns once all the cpus called it.
+    void wait();
+
+private:
+    uint32_t m_count;
+    volatile uint32_t m_remaining;
+    volatile uint32_t m_sense;
+};
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "x86/common.h"
+
+
+namespace x86::bitmap {
+
+// helpers for bitmaps stored as an array of 64 bit words,
+// bit N is bit (N % 64) of word (N / 64), which matches the
+// byte layout the cpu expects for its bitmaps (msr/io/vmcs-field).
+// range operations work a whole word at a time.
+
+static constexpr size_t bits_in_word = sizeof(uint64_t) * 8;
+
+static inline bool test(const uint64_t* words, size_t index) {
+    return (words[index / bits_in_word] & bit(index % bits_in_word)) != 0;
+}
+
+static inline void set(uint64_t* words, size_t index) {
+    words[index / bits_in_word] |= bit(index % bits_in_word);
+}
+
+static inline void clear(uint64_t* words, size_t index) {
+    words[index / bits_in_word] &= ~bit(index % bits_in_word);
+}
+
+// mask of bits [first, first + count) inside a single word.
+static inline uint64_t word_mask(size_t first, size_t count) {
+    const auto high = count == bits_in_word ? ~0ull : bit(count) - 1;
+    return high << first;
+}
+
+static inline void set_range(uint64_t* words, size_t first, size_t count) {
+    while (count > 0) {
+        const auto offset = first % bits_in_word;
+        const auto in_word = (bits_in_word - offset) < count ? (bits_in_word - offset) : count;
+
+        words[first / bits_in_word] |= word_mask(offset, in_word);
+
+        first += in_word;
+        count -= in_word;
+    }
+}
+
+static inline void clear_range(uint64_t* words, size_t first, size_t count) {
+    while (count > 0) {
+        const auto offset = first % bits_in_word;
+        const auto in_word = (bits_in_word - offset) < count ? (bits_in_word - offset) : count;
+
+        words[first / bits_in_word] &= ~word_mask(offset, in_word);
+
+        first += in_word;
+        count -= in_word;
+    }
+}
+
+static inline void fill(uint64_t* words, size_t word_count, bool value) {
+    const auto pattern = value ? ~0ull : 0ull;
+    for (size_t i = 0; i < word_count; ++i) {
+        words[i] = pattern;
+    }
+}
+
+}
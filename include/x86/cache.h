@@ -0,0 +1,29 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/cr.h"
+
+
+namespace x86::cache {
+
+// write back and invalidate all the caches of the cpu [SDM 2 "WBINVD"].
+// this can take a long time (milliseconds on large caches), and is not interruptible.
+static inline void wbinvd() {
+    asm volatile("wbinvd" ::: "memory");
+}
+
+// No-fill cache mode, for changing the memory types of the cpu (mtrr and pat)
+// [SDM 3 11.11.7.2 steps 4-7 and 11-13] [SDM 3 11.12.4].
+// interrupts must be disabled between enter and exit, and in mp systems all the cpus
+// must do the change together.
+struct no_fill_state_t {
+    cr0_t cr0;
+    cr4_t cr4;
+};
+
+// CR0.CD = 1, CR0.NW = 0, then flushes the caches and tlbs.
+no_fill_state_t enter_no_fill_mode();
+// flushes the caches and tlbs again and restores CR0 and CR4.
+void exit_no_fill_mode(const no_fill_state_t& state);
+
+}
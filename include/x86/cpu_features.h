@@ -0,0 +1,270 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/cpuid.h"
+
+
+namespace x86 {
+
+// CPU feature database.
+// cpuid is serializing (and exits when running as a guest), so the leaves are captured
+// once into cpu_features_t and feature checks read it instead. with a constexpr feature
+// descriptor the location of the bit is known at compile time, so a check is one load
+// and one test.
+// subleaf 0 of the basic leaves 0x0 - 0x1f and the extended leaves 0x80000000 - 0x8000001f
+// are captured, along with the subleaves listed in cpu_features_t::captured_subleaves.
+// leaves the cpu doesn't support are left as 0, so their features read as not supported.
+
+enum class cpuid_register_t : uint8_t {
+    eax = 0,
+    ebx = 1,
+    ecx = 2,
+    edx = 3
+};
+
+struct cpu_feature_t {
+    cpuid_t leaf;
+    cpuid_register_t reg;
+    uint8_t bit;
+    cpuid_t subleaf = 0;
+};
+
+namespace features {
+
+// [SDM 2 "CPUID" Table 3-10]
+static constexpr cpu_feature_t sse3{0x1, cpuid_register_t::ecx, 0};
+static constexpr cpu_feature_t pclmulqdq{0x1, cpuid_register_t::ecx, 1};
+static constexpr cpu_feature_t monitor{0x1, cpuid_register_t::ecx, 3};
+static constexpr cpu_feature_t vmx{0x1, cpuid_register_t::ecx, 5};
+static constexpr cpu_feature_t smx{0x1, cpuid_register_t::ecx, 6};
+static constexpr cpu_feature_t ssse3{0x1, cpuid_register_t::ecx, 9};
+static constexpr cpu_feature_t fma{0x1, cpuid_register_t::ecx, 12};
+static constexpr cpu_feature_t cmpxchg16b{0x1, cpuid_register_t::ecx, 13};
+static constexpr cpu_feature_t pdcm{0x1, cpuid_register_t::ecx, 15};
+static constexpr cpu_feature_t pcid{0x1, cpuid_register_t::ecx, 17};
+static constexpr cpu_feature_t sse41{0x1, cpuid_register_t::ecx, 19};
+static constexpr cpu_feature_t sse42{0x1, cpuid_register_t::ecx, 20};
+static constexpr cpu_feature_t x2apic{0x1, cpuid_register_t::ecx, 21};
+static constexpr cpu_feature_t movbe{0x1, cpuid_register_t::ecx, 22};
+static constexpr cpu_feature_t popcnt{0x1, cpuid_register_t::ecx, 23};
+static constexpr cpu_feature_t tsc_deadline{0x1, cpuid_register_t::ecx, 24};
+static constexpr cpu_feature_t aes{0x1, cpuid_register_t::ecx, 25};
+static constexpr cpu_feature_t xsave{0x1, cpuid_register_t::ecx, 26};
+static constexpr cpu_feature_t osxsave{0x1, cpuid_register_t::ecx, 27};
+static constexpr cpu_feature_t avx{0x1, cpuid_register_t::ecx, 28};
+static constexpr cpu_feature_t f16c{0x1, cpuid_register_t::ecx, 29};
+static constexpr cpu_feature_t rdrand{0x1, cpuid_register_t::ecx, 30};
+static constexpr cpu_feature_t hypervisor{0x1, cpuid_register_t::ecx, 31};
+
+// [SDM 2 "CPUID" Table 3-11]
+static constexpr cpu_feature_t fpu{0x1, cpuid_register_t::edx, 0};
+static constexpr cpu_feature_t vme{0x1, cpuid_register_t::edx, 1};
+static constexpr cpu_feature_t de{0x1, cpuid_register_t::edx, 2};
+static constexpr cpu_feature_t pse{0x1, cpuid_register_t::edx, 3};
+static constexpr cpu_feature_t tsc{0x1, cpuid_register_t::edx, 4};
+static constexpr cpu_feature_t msr{0x1, cpuid_register_t::edx, 5};
+static constexpr cpu_feature_t pae{0x1, cpuid_register_t::edx, 6};
+static constexpr cpu_feature_t mce{0x1, cpuid_register_t::edx, 7};
+static constexpr cpu_feature_t cx8{0x1, cpuid_register_t::edx, 8};
+static constexpr cpu_feature_t apic{0x1, cpuid_register_t::edx, 9};
+static constexpr cpu_feature_t sep{0x1, cpuid_register_t::edx, 11};
+static constexpr cpu_feature_t mtrr{0x1, cpuid_register_t::edx, 12};
+static constexpr cpu_feature_t pge{0x1, cpuid_register_t::edx, 13};
+static constexpr cpu_feature_t mca{0x1, cpuid_register_t::edx, 14};
+static constexpr cpu_feature_t cmov{0x1, cpuid_register_t::edx, 15};
+static constexpr cpu_feature_t pat{0x1, cpuid_register_t::edx, 16};
+static constexpr cpu_feature_t pse36{0x1, cpuid_register_t::edx, 17};
+static constexpr cpu_feature_t clfsh{0x1, cpuid_register_t::edx, 19};
+static constexpr cpu_feature_t mmx{0x1, cpuid_register_t::edx, 23};
+static constexpr cpu_feature_t fxsr{0x1, cpuid_register_t::edx, 24};
+static constexpr cpu_feature_t sse{0x1, cpuid_register_t::edx, 25};
+static constexpr cpu_feature_t sse2{0x1, cpuid_register_t::edx, 26};
+static constexpr cpu_feature_t self_snoop{0x1, cpuid_register_t::edx, 27};
+static constexpr cpu_feature_t htt{0x1, cpuid_register_t::edx, 28};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 6]
+static constexpr cpu_feature_t arat{0x6, cpuid_register_t::eax, 2};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 7 subleaf 0]
+static constexpr cpu_feature_t fsgsbase{0x7, cpuid_register_t::ebx, 0};
+static constexpr cpu_feature_t tsc_adjust{0x7, cpuid_register_t::ebx, 1};
+static constexpr cpu_feature_t sgx{0x7, cpuid_register_t::ebx, 2};
+static constexpr cpu_feature_t bmi1{0x7, cpuid_register_t::ebx, 3};
+static constexpr cpu_feature_t hle{0x7, cpuid_register_t::ebx, 4};
+static constexpr cpu_feature_t avx2{0x7, cpuid_register_t::ebx, 5};
+static constexpr cpu_feature_t smep{0x7, cpuid_register_t::ebx, 7};
+static constexpr cpu_feature_t bmi2{0x7, cpuid_register_t::ebx, 8};
+static constexpr cpu_feature_t erms{0x7, cpuid_register_t::ebx, 9};
+static constexpr cpu_feature_t invpcid{0x7, cpuid_register_t::ebx, 10};
+static constexpr cpu_feature_t rtm{0x7, cpuid_register_t::ebx, 11};
+static constexpr cpu_feature_t avx512f{0x7, cpuid_register_t::ebx, 16};
+static constexpr cpu_feature_t avx512dq{0x7, cpuid_register_t::ebx, 17};
+static constexpr cpu_feature_t rdseed{0x7, cpuid_register_t::ebx, 18};
+static constexpr cpu_feature_t adx{0x7, cpuid_register_t::ebx, 19};
+static constexpr cpu_feature_t smap{0x7, cpuid_register_t::ebx, 20};
+static constexpr cpu_feature_t avx512_ifma{0x7, cpuid_register_t::ebx, 21};
+static constexpr cpu_feature_t clflushopt{0x7, cpuid_register_t::ebx, 23};
+static constexpr cpu_feature_t clwb{0x7, cpuid_register_t::ebx, 24};
+static constexpr cpu_feature_t avx512cd{0x7, cpuid_register_t::ebx, 28};
+static constexpr cpu_feature_t sha{0x7, cpuid_register_t::ebx, 29};
+static constexpr cpu_feature_t avx512bw{0x7, cpuid_register_t::ebx, 30};
+static constexpr cpu_feature_t avx512vl{0x7, cpuid_register_t::ebx, 31};
+static constexpr cpu_feature_t avx512_vbmi{0x7, cpuid_register_t::ecx, 1};
+static constexpr cpu_feature_t umip{0x7, cpuid_register_t::ecx, 2};
+static constexpr cpu_feature_t pku{0x7, cpuid_register_t::ecx, 3};
+static constexpr cpu_feature_t waitpkg{0x7, cpuid_register_t::ecx, 5};
+static constexpr cpu_feature_t gfni{0x7, cpuid_register_t::ecx, 8};
+static constexpr cpu_feature_t vaes{0x7, cpuid_register_t::ecx, 9};
+static constexpr cpu_feature_t vpclmulqdq{0x7, cpuid_register_t::ecx, 10};
+static constexpr cpu_feature_t avx512_vnni{0x7, cpuid_register_t::ecx, 11};
+static constexpr cpu_feature_t la57{0x7, cpuid_register_t::ecx, 16};
+static constexpr cpu_feature_t rdpid{0x7, cpuid_register_t::ecx, 22};
+static constexpr cpu_feature_t movdiri{0x7, cpuid_register_t::ecx, 27};
+static constexpr cpu_feature_t movdir64b{0x7, cpuid_register_t::ecx, 28};
+static constexpr cpu_feature_t fsrm{0x7, cpuid_register_t::edx, 4};
+static constexpr cpu_feature_t md_clear{0x7, cpuid_register_t::edx, 10};
+static constexpr cpu_feature_t serialize{0x7, cpuid_register_t::edx, 14};
+static constexpr cpu_feature_t hybrid{0x7, cpuid_register_t::edx, 15};
+static constexpr cpu_feature_t ibrs_ibpb{0x7, cpuid_register_t::edx, 26};
+static constexpr cpu_feature_t stibp{0x7, cpuid_register_t::edx, 27};
+static constexpr cpu_feature_t l1d_flush{0x7, cpuid_register_t::edx, 28};
+static constexpr cpu_feature_t arch_capabilities{0x7, cpuid_register_t::edx, 29};
+static constexpr cpu_feature_t ssbd{0x7, cpuid_register_t::edx, 31};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 7 subleaf 1]
+static constexpr cpu_feature_t avx_vnni{0x7, cpuid_register_t::eax, 4, 1};
+static constexpr cpu_feature_t avx512_bf16{0x7, cpuid_register_t::eax, 5, 1};
+static constexpr cpu_feature_t fzrm{0x7, cpuid_register_t::eax, 10, 1};
+static constexpr cpu_feature_t fsrs{0x7, cpuid_register_t::eax, 11, 1};
+static constexpr cpu_feature_t fsrcs{0x7, cpuid_register_t::eax, 12, 1};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0xd subleaf 1]
+static constexpr cpu_feature_t xsaveopt{0xd, cpuid_register_t::eax, 0, 1};
+static constexpr cpu_feature_t xsavec{0xd, cpuid_register_t::eax, 1, 1};
+static constexpr cpu_feature_t xgetbv_ecx1{0xd, cpuid_register_t::eax, 2, 1};
+static constexpr cpu_feature_t xsaves{0xd, cpuid_register_t::eax, 3, 1};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0x80000001]
+static constexpr cpu_feature_t lahf_lm{0x80000001, cpuid_register_t::ecx, 0};
+static constexpr cpu_feature_t lzcnt{0x80000001, cpuid_register_t::ecx, 5};
+static constexpr cpu_feature_t syscall{0x80000001, cpuid_register_t::edx, 11};
+static constexpr cpu_feature_t nx{0x80000001, cpuid_register_t::edx, 20};
+static constexpr cpu_feature_t page1gb{0x80000001, cpuid_register_t::edx, 26};
+static constexpr cpu_feature_t rdtscp{0x80000001, cpuid_register_t::edx, 27};
+static constexpr cpu_feature_t long_mode{0x80000001, cpuid_register_t::edx, 29};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0x80000007]
+static constexpr cpu_feature_t invariant_tsc{0x80000007, cpuid_register_t::edx, 8};
+
+}
+
+struct cpu_features_t {
+    static constexpr cpuid_t basic_first = 0x0;
+    static constexpr cpuid_t extended_first = 0x80000000;
+    static constexpr size_t basic_leaves = 0x20;
+    static constexpr size_t extended_leaves = 0x20;
+
+    // subleaves other than 0 which are captured, {leaf, subleaf}
+    static constexpr cpuid_t captured_subleaves[][2] = {
+        {0x7, 0x1},
+        {0xd, 0x1},
+    };
+    static constexpr size_t subleaf_count = sizeof(captured_subleaves) / sizeof(captured_subleaves[0]);
+    static constexpr size_t no_index = static_cast<size_t>(-1);
+
+    static constexpr size_t index_of(cpuid_t leaf, cpuid_t subleaf = 0) {
+        if (subleaf != 0) {
+            for (size_t i = 0; i < subleaf_count; ++i) {
+                if (captured_subleaves[i][0] == leaf && captured_subleaves[i][1] == subleaf) {
+                    return basic_leaves + extended_leaves + i;
+                }
+            }
+            return no_index;
+        }
+
+        if (leaf >= basic_first && leaf < basic_first + basic_leaves) {
+            return leaf - basic_first;
+        }
+        if (leaf >= extended_first && leaf < extended_first + extended_leaves) {
+            return basic_leaves + (leaf - extended_first);
+        }
+        return no_index;
+    }
+
+    static constexpr bool is_captured(cpuid_t leaf, cpuid_t subleaf = 0) {
+        return index_of(leaf, subleaf) != no_index;
+    }
+
+    cpuid_t max_basic_leaf;
+    cpuid_t max_extended_leaf;
+    bool loaded;
+    uint32_t regs[basic_leaves + extended_leaves + subleaf_count][4];
+
+    // executes cpuid on the current cpu to fill this instance, for callers which keep
+    // a copy per cpu. cpu_features() holds the copy made on the boot cpu.
+    void load();
+
+    bool is_leaf_supported(cpuid_t leaf) const;
+    cpuid_regs_t leaf(cpuid_t leaf, cpuid_t subleaf = 0) const;
+
+    // the captured leaf in the layout of its define_cpuid type, zeros if the leaf isn't
+    // supported (like leaf()).
+    template<
+            typename _t,
+            typename meta::enable_if<
+                    is_cpuid_def<_t>::value,
+                    bool>::type = 0
+    >
+    _t leaf() const {
+        static_assert(is_captured(_t::leaf, _t::subleaf), "leaf not captured");
+        static_assert(sizeof(_t) == sizeof(regs[0]), "bad CPUID size");
+
+        _t typed{};
+        memcpy(&typed, regs[index_of(_t::leaf, _t::subleaf)], sizeof(typed));
+        return typed;
+    }
+
+    template<cpu_feature_t _feature>
+    bool has() const {
+        static_assert(is_captured(_feature.leaf, _feature.subleaf), "leaf not captured");
+        constexpr auto index = index_of(_feature.leaf, _feature.subleaf);
+        constexpr auto reg = static_cast<size_t>(_feature.reg);
+        return (regs[index][reg] & bit(_feature.bit)) != 0;
+    }
+
+    bool has(const cpu_feature_t& feature) const {
+        const auto index = index_of(feature.leaf, feature.subleaf);
+        if (index == no_index) {
+            return false;
+        }
+
+        return (regs[index][static_cast<size_t>(feature.reg)] & bit(feature.bit)) != 0;
+    }
+} __attribute__((aligned(64)));
+
+namespace detail {
+
+extern cpu_features_t g_cpu_features;
+
+}
+
+// fills the database from cpuid on the current cpu. done once, on the first call to
+// cpu_features() or here (to pay for it up front, on the boot cpu). concurrent first
+// calls are synchronized, the others wait for the one loading. after that the database
+// is only read, so has_feature<>() is a load and a test. the database is shared by all
+// the cpus, the features are expected to be the same on all of them.
+void load_cpu_features();
+
+inline const cpu_features_t& cpu_features() {
+    if (__builtin_expect(!detail::g_cpu_features.loaded, false)) {
+        load_cpu_features();
+    }
+    return detail::g_cpu_features;
+}
+
+template<cpu_feature_t _feature>
+inline bool has_feature() {
+    return cpu_features().has<_feature>();
+}
+
+}
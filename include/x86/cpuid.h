@@ -58,6 +58,15 @@ struct cpuid_def_t : public _cpuid_base_t<_leaf, _subleaf> {
     uint32_t edx;
 };
 
+// registers of a leaf known only at runtime
+struct cpuid_regs_t {
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+};
+static_assert(sizeof(cpuid_regs_t) == cpuid_def_size, "sizeof(cpuid_regs_t)");
+
 template<typename T>
 struct is_cpuid_def : public meta::false_type {};
 template<cpuid_t _leaf, cpuid_t _subleaf>
@@ -73,6 +82,10 @@ uint32_t extended_model_id : 4;
 uint32_t extended_family_id : 8;
 uint32_t reserved1 : 4;
 ,
+uint32_t brand_index : 8;
+uint32_t clflush_line_size : 8;
+uint32_t max_logical_processors : 8;
+uint32_t initial_apic_id : 8;
 ,
 uint32_t sse3 : 1;
 uint32_t pclmulqdq : 1;
@@ -138,6 +151,289 @@ uint32_t reserved1 : 1;
 uint32_t pbe : 1;
 );
 
+// [SDM 2 "CPUID" Table 3-8, leaf 4] deterministic cache parameters.
+// subleaf N describes cache N, until a subleaf with cache_type == null.
+// the counts are reported minus 1.
+define_cpuid(0x4, 0x0, cpuid_eax04,
+uint32_t cache_type : 5;
+uint32_t cache_level : 3;
+uint32_t self_initializing : 1;
+uint32_t fully_associative : 1;
+uint32_t reserved0 : 4;
+uint32_t max_sharing_ids : 12;
+uint32_t max_core_ids : 6;
+,
+uint32_t line_size : 12;
+uint32_t partitions : 10;
+uint32_t ways : 10;
+,
+uint32_t sets : 32;
+,
+uint32_t wbinvd_no_lower_levels : 1;
+uint32_t inclusive : 1;
+uint32_t complex_indexing : 1;
+uint32_t reserved0 : 29;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0xa] [SDM 3 20.2] architectural performance monitoring
+define_cpuid(0xa, 0x0, cpuid_eax0a,
+uint32_t version : 8;
+uint32_t gp_counters : 8;
+uint32_t gp_width : 8;
+uint32_t events_length : 8;
+,
+// set if the event is NOT available
+uint32_t core_cycles : 1;
+uint32_t instructions_retired : 1;
+uint32_t reference_cycles : 1;
+uint32_t llc_references : 1;
+uint32_t llc_misses : 1;
+uint32_t branch_instructions_retired : 1;
+uint32_t branch_misses_retired : 1;
+uint32_t topdown_slots : 1;
+uint32_t reserved0 : 24;
+,
+// supported fixed counters (version 5)
+uint32_t fixed_counters_mask : 32;
+,
+uint32_t fixed_counters : 5;
+uint32_t fixed_width : 8;
+uint32_t reserved0 : 2;
+uint32_t any_thread_deprecated : 1;
+uint32_t reserved1 : 16;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0xb] extended topology enumeration.
+// subleaf N describes topology level N, until a subleaf with level_type == invalid.
+define_cpuid(0xb, 0x0, cpuid_eax0b,
+uint32_t shift : 5;
+uint32_t reserved0 : 27;
+,
+uint32_t logical_processors : 16;
+uint32_t reserved0 : 16;
+,
+uint32_t level_number : 8;
+uint32_t level_type : 8;
+uint32_t reserved0 : 16;
+,
+uint32_t x2apic_id : 32;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0x1f] v2 extended topology enumeration.
+// same layout as leaf 0xb, with the module, tile and die level types.
+define_cpuid(0x1f, 0x0, cpuid_eax1f,
+uint32_t shift : 5;
+uint32_t reserved0 : 27;
+,
+uint32_t logical_processors : 16;
+uint32_t reserved0 : 16;
+,
+uint32_t level_number : 8;
+uint32_t level_type : 8;
+uint32_t reserved0 : 16;
+,
+uint32_t x2apic_id : 32;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 7 subleaf 0]
+define_cpuid(0x7, 0x0, cpuid_eax07_ecx00,
+uint32_t max_subleaf : 32;
+,
+uint32_t fsgsbase : 1;
+uint32_t tsc_adjust : 1;
+uint32_t sgx : 1;
+uint32_t bmi1 : 1;
+uint32_t hle : 1;
+uint32_t avx2 : 1;
+uint32_t fdp_excptn_only : 1;
+uint32_t smep : 1;
+uint32_t bmi2 : 1;
+uint32_t erms : 1;
+uint32_t invpcid : 1;
+uint32_t rtm : 1;
+uint32_t rdt_m : 1;
+uint32_t fpu_cs_ds_deprecated : 1;
+uint32_t mpx : 1;
+uint32_t rdt_a : 1;
+uint32_t avx512f : 1;
+uint32_t avx512dq : 1;
+uint32_t rdseed : 1;
+uint32_t adx : 1;
+uint32_t smap : 1;
+uint32_t avx512_ifma : 1;
+uint32_t reserved0 : 1;
+uint32_t clflushopt : 1;
+uint32_t clwb : 1;
+uint32_t intel_pt : 1;
+uint32_t avx512pf : 1;
+uint32_t avx512er : 1;
+uint32_t avx512cd : 1;
+uint32_t sha : 1;
+uint32_t avx512bw : 1;
+uint32_t avx512vl : 1;
+,
+uint32_t prefetchwt1 : 1;
+uint32_t avx512_vbmi : 1;
+uint32_t umip : 1;
+uint32_t pku : 1;
+uint32_t ospke : 1;
+uint32_t waitpkg : 1;
+uint32_t avx512_vbmi2 : 1;
+uint32_t cet_ss : 1;
+uint32_t gfni : 1;
+uint32_t vaes : 1;
+uint32_t vpclmulqdq : 1;
+uint32_t avx512_vnni : 1;
+uint32_t avx512_bitalg : 1;
+uint32_t tme_en : 1;
+uint32_t avx512_vpopcntdq : 1;
+uint32_t reserved0 : 1;
+uint32_t la57 : 1;
+uint32_t mawau : 5;
+uint32_t rdpid : 1;
+uint32_t kl : 1;
+uint32_t bus_lock_detect : 1;
+uint32_t cldemote : 1;
+uint32_t reserved1 : 1;
+uint32_t movdiri : 1;
+uint32_t movdir64b : 1;
+uint32_t enqcmd : 1;
+uint32_t sgx_lc : 1;
+uint32_t pks : 1;
+,
+uint32_t reserved0 : 1;
+uint32_t sgx_keys : 1;
+uint32_t avx512_4vnniw : 1;
+uint32_t avx512_4fmaps : 1;
+uint32_t fsrm : 1;
+uint32_t uintr : 1;
+uint32_t reserved1 : 2;
+uint32_t avx512_vp2intersect : 1;
+uint32_t srbds_ctrl : 1;
+uint32_t md_clear : 1;
+uint32_t rtm_always_abort : 1;
+uint32_t reserved2 : 1;
+uint32_t rtm_force_abort : 1;
+uint32_t serialize : 1;
+uint32_t hybrid : 1;
+uint32_t tsxldtrk : 1;
+uint32_t reserved3 : 1;
+uint32_t pconfig : 1;
+uint32_t arch_lbr : 1;
+uint32_t cet_ibt : 1;
+uint32_t reserved4 : 1;
+uint32_t amx_bf16 : 1;
+uint32_t avx512_fp16 : 1;
+uint32_t amx_tile : 1;
+uint32_t amx_int8 : 1;
+uint32_t ibrs_ibpb : 1;
+uint32_t stibp : 1;
+uint32_t l1d_flush : 1;
+uint32_t arch_capabilities : 1;
+uint32_t core_capabilities : 1;
+uint32_t ssbd : 1;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 7 subleaf 1]
+define_cpuid(0x7, 0x1, cpuid_eax07_ecx01,
+uint32_t reserved0 : 4;
+uint32_t avx_vnni : 1;
+uint32_t avx512_bf16 : 1;
+uint32_t reserved1 : 4;
+uint32_t fzrm : 1;
+uint32_t fsrs : 1;
+uint32_t fsrcs : 1;
+uint32_t reserved2 : 9;
+uint32_t hreset : 1;
+uint32_t avx_ifma : 1;
+uint32_t reserved3 : 2;
+uint32_t lam : 1;
+uint32_t reserved4 : 5;
+,,,
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0xd subleaf 0] [SDM 1 13.2]
+define_cpuid(0xd, 0x0, cpuid_eax0d_ecx00,
+// state components supported in xcr0 (low 32 bits)
+uint32_t x87 : 1;
+uint32_t sse : 1;
+uint32_t avx : 1;
+uint32_t bndregs : 1;
+uint32_t bndcsr : 1;
+uint32_t opmask : 1;
+uint32_t zmm_hi256 : 1;
+uint32_t hi16_zmm : 1;
+uint32_t reserved0 : 1;
+uint32_t pkru : 1;
+uint32_t reserved1 : 7;
+uint32_t tilecfg : 1;
+uint32_t tiledata : 1;
+uint32_t reserved2 : 13;
+,
+// size of the xsave area for the components enabled in xcr0
+uint32_t enabled_size : 32;
+,
+// size of the xsave area for all the supported components
+uint32_t max_size : 32;
+,
+// state components supported in xcr0 (high 32 bits)
+uint32_t xcr0_high : 32;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0xd subleaf 1]
+define_cpuid(0xd, 0x1, cpuid_eax0d_ecx01,
+uint32_t xsaveopt : 1;
+uint32_t xsavec : 1;
+uint32_t xgetbv_ecx1 : 1;
+uint32_t xsaves : 1;
+uint32_t xfd : 1;
+uint32_t reserved0 : 27;
+,
+// size of the xsave area for the components enabled in xcr0 | ia32_xss
+uint32_t enabled_size : 32;
+,
+// state components supported in ia32_xss (low 32 bits)
+uint32_t reserved0 : 8;
+uint32_t pt : 1;
+uint32_t reserved1 : 1;
+uint32_t pasid : 1;
+uint32_t cet_user : 1;
+uint32_t cet_supervisor : 1;
+uint32_t hdc : 1;
+uint32_t uintr : 1;
+uint32_t lbr : 1;
+uint32_t hwp : 1;
+uint32_t reserved2 : 15;
+,
+// state components supported in ia32_xss (high 32 bits)
+uint32_t xss_high : 32;
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0x15] [SDM 3 19.7.3]
+// tsc frequency = crystal_hz * numerator / denominator
+define_cpuid(0x15, 0x0, cpuid_eax15,
+uint32_t denominator : 32;
+,
+uint32_t numerator : 32;
+,
+// 0 if not enumerated
+uint32_t crystal_hz : 32;
+,
+);
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0x16]
+define_cpuid(0x16, 0x0, cpuid_eax16,
+uint32_t base_mhz : 16;
+uint32_t reserved0 : 16;
+,
+uint32_t max_mhz : 16;
+uint32_t reserved0 : 16;
+,
+uint32_t bus_mhz : 16;
+uint32_t reserved0 : 16;
+,
+);
+
 define_cpuid(0x80000001, 0x0, cpuid_extended_processor_info,
 ,,,
 uint32_t fpu : 1;
@@ -200,4 +496,32 @@ inline cpuid_def_t<_leaf, _subleaf> cpuid() {
     return cpuid<cpuid_def_t<_leaf, _subleaf>>();
 }
 
+// reads another subleaf of a leaf whose subleaves share the layout of _t
+// (such as leaf 4, 0xb and 0x1f).
+template<
+        typename _t,
+        typename meta::enable_if<
+                is_cpuid_def<_t>::value,
+                bool>::type = 0
+>
+inline _t cpuid(cpuid_t subleaf) {
+    static_assert(sizeof(_t) == cpuid_def_size, "bad CPUID size");
+
+    _t regs{};
+    asm volatile("cpuid"
+    : "=a"(regs.eax), "=b"(regs.ebx), "=c"(regs.ecx), "=d"(regs.edx)
+    : "0"(_t::leaf), "2"(subleaf));
+
+    return regs;
+}
+
+inline cpuid_regs_t cpuid(cpuid_t leaf, cpuid_t subleaf = 0) {
+    cpuid_regs_t regs{};
+    asm volatile("cpuid"
+    : "=a"(regs.eax), "=b"(regs.ebx), "=c"(regs.ecx), "=d"(regs.edx)
+    : "0"(leaf), "2"(subleaf));
+
+    return regs;
+}
+
 }
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/cpu_features.h"
+
+
+namespace x86::dispatch {
+
+// Runtime selection between implementations of the same function.
+// each implementation comes with a check of what it needs from the cpu, and the best
+// supported one is resolved once (at init) into a function pointer, so calls pay only
+// for an indirect call and no feature checks.
+//
+//  static const dispatch::variant_t<copy_fn_t> variants[] = {
+//      {copy_generic, dispatch::always},
+//      {copy_erms, dispatch::supports<features::erms>},
+//  };
+//  dispatch::select(variants);
+
+// x86-64 micro-architecture levels (psABI), for selecting by a set of features at once.
+// the levels which use avx registers also require the os to have enabled their state
+// in xcr0.
+enum class level_t : uint8_t {
+    // sse2
+    baseline = 0,
+    // + cmpxchg16b, lahf/sahf, popcnt, sse3, sse4.1, sse4.2, ssse3
+    v2 = 1,
+    // + avx, avx2, bmi1, bmi2, f16c, fma, lzcnt, movbe, xsave (os enabled)
+    v3 = 2,
+    // + avx512f, avx512bw, avx512cd, avx512dq, avx512vl (os enabled)
+    v4 = 3
+};
+
+level_t current_level();
+
+template<typename _fn>
+struct variant_t {
+    _fn function;
+    bool (*is_supported)();
+};
+
+inline bool always() {
+    return true;
+}
+
+template<cpu_feature_t... _features>
+inline bool supports() {
+    const auto& cpu = cpu_features();
+    return (cpu.has<_features>() && ...);
+}
+
+template<level_t _level>
+inline bool at_least() {
+    return current_level() >= _level;
+}
+
+// variants are ordered from the most generic to the best, the last supported one is
+// returned. the first variant is the fallback, and should always be supported.
+template<typename _fn, size_t _count>
+_fn select(const variant_t<_fn> (&variants)[_count]) {
+    static_assert(_count > 0, "no variants");
+
+    for (size_t i = _count; i > 1; --i) {
+        if (variants[i - 1].is_supported()) {
+            return variants[i - 1].function;
+        }
+    }
+
+    return variants[0].function;
+}
+
+// function pointer which starts as the fallback, so it can be called before resolve().
+template<typename _fn>
+class dispatcher_t {
+public:
+    constexpr explicit dispatcher_t(_fn fallback)
+        : m_function(fallback)
+    {}
+
+    template<size_t _count>
+    void resolve(const variant_t<_fn> (&variants)[_count]) {
+        m_function = select(variants);
+    }
+
+    _fn get() const {
+        return m_function;
+    }
+
+    template<typename... _args>
+    decltype(auto) operator()(_args... args) const {
+        return m_function(args...);
+    }
+
+private:
+    _fn m_function;
+};
+
+}
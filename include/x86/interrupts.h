@@ -121,6 +121,17 @@ private:
     idtr_t m_idtr;
 };
 
+// clears rflags.IF and returns the previous rflags, for restore()
+static inline uint64_t save_and_disable() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void restore(uint64_t flags) {
+    asm volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
 }
 
 allow_struct_read_write(interrupts::idtr_t);
@@ -32,3 +32,45 @@ static inline size_t bit_scan_reverse(uint64_t value) {
             : "=r"(size) : "r" (value));
     return size;
 }
+
+// (value * multiplier) >> shift, with a 128 bit intermediate product.
+static inline uint64_t mul_shift(uint64_t value, uint64_t multiplier, size_t shift) {
+    uint64_t low;
+    uint64_t high;
+    asm("mulq %3"
+            : "=a"(low), "=d"(high) : "a"(value), "rm"(multiplier) : "cc");
+
+    if (shift == 0) {
+        return low;
+    }
+    if (shift >= 64) {
+        return high >> (shift - 64);
+    }
+
+    return (low >> shift) | (high << (64 - shift));
+}
+
+// (value * multiplier) / divisor, with a 128 bit intermediate product.
+// the result must fit in 64 bits (high part of the product < divisor), otherwise #DE.
+static inline uint64_t mul_div(uint64_t value, uint64_t multiplier, uint64_t divisor) {
+    uint64_t low;
+    uint64_t high;
+    asm("mulq %3"
+            : "=a"(low), "=d"(high) : "a"(value), "rm"(multiplier) : "cc");
+
+    uint64_t quotient;
+    uint64_t remainder;
+    asm("divq %4"
+            : "=a"(quotient), "=d"(remainder) : "a"(low), "d"(high), "rm"(divisor) : "cc");
+
+    return quotient;
+}
+
+// reads an extended control register (index 0 = xcr0). requires CR4.OSXSAVE = 1.
+static inline uint64_t xgetbv(uint32_t index) {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("xgetbv"
+            : "=a"(low), "=d"(high) : "c"(index));
+    return (static_cast<uint64_t>(high) << 32) | low;
+}
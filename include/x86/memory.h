@@ -0,0 +1,30 @@
+#pragma once
+
+#include "x86/common.h"
+
+
+namespace x86::memory {
+
+// Memory copy/fill kernels, with a variant chosen for the cpu by initialize().
+// - qwords: rep movsq/stosq for the bulk and rep movsb/stosb for the tail, for any cpu.
+// - erms: a single rep movsb/stosb, which cpus with ERMS (CPUID.7.0:EBX[9]) run in
+//   large internal chunks [Optimization Manual 3.7.6].
+// these don't use vector registers, so they are safe to use in code which doesn't
+// save the extended state (e.g. interrupt and vmexit handlers).
+// they can back the extern memcpy/memset the library expects from its environment.
+
+using copy_fn_t = void (*)(void* dest, const void* src, size_t size);
+using fill_fn_t = void (*)(void* dest, uint8_t value, size_t size);
+
+void copy_qwords(void* dest, const void* src, size_t size);
+void copy_erms(void* dest, const void* src, size_t size);
+void fill_qwords(void* dest, uint8_t value, size_t size);
+void fill_erms(void* dest, uint8_t value, size_t size);
+
+// selects the variants for this cpu. until called, the qword variants are used.
+void initialize();
+
+void copy(void* dest, const void* src, size_t size);
+void fill(void* dest, uint8_t value, size_t size);
+
+}
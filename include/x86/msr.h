@@ -51,6 +51,14 @@ define_msr(0xc0000101, ia32_gs_base,
 
 )
 
+define_msr(0xc0000103, ia32_tsc_aux,
+value_t aux : 32;
+value_t reserved0 : 32;
+)
+
+define_msr(0x10, ia32_time_stamp_counter,
+)
+
 define_msr(0xc0000080, ia32_efer,
 value_t sce : 1;
 value_t reserved0 : 7;
@@ -81,6 +89,30 @@ value_t global_enable : 1;
 value_t base : 52;
 )
 
+// [SDM 4 "MSR_PLATFORM_INFO"] model specific (intel family 6, since nehalem)
+define_msr(0xce, msr_platform_info,
+value_t reserved0 : 8;
+value_t max_non_turbo_ratio : 8;
+value_t reserved1 : 48;
+)
+
+// [SDM 3 10.5.4.1] 0 disarms the timer
+define_msr(0x6e0, ia32_tsc_deadline,
+)
+
+// [SDM 3 34.15.5] dual-monitor treatment of SMIs
+define_msr(0x9b, ia32_smm_monitor_ctl,
+value_t valid : 1;
+value_t reserved0 : 1;
+value_t vmxoff_unblocks_smi : 1;
+value_t reserved1 : 9;
+value_t mseg_base : 20;
+value_t reserved2 : 32;
+)
+
+define_msr(0x9e, ia32_smbase,
+)
+
 define_msr(0x1d9, ia32_debugctl,
 value_t lbr : 1;
 value_t btf : 1;
@@ -144,6 +176,61 @@ value_t ia32_fixed_ctr2 : 1;
 value_t reserved1 : 29;
 )
 
+// [SDM 3 20.2.2]
+define_msr(0x38d, ia32_fixed_ctr_ctrl,
+value_t ctr0_os : 1;
+value_t ctr0_usr : 1;
+value_t ctr0_any_thread : 1;
+value_t ctr0_pmi : 1;
+value_t ctr1_os : 1;
+value_t ctr1_usr : 1;
+value_t ctr1_any_thread : 1;
+value_t ctr1_pmi : 1;
+value_t ctr2_os : 1;
+value_t ctr2_usr : 1;
+value_t ctr2_any_thread : 1;
+value_t ctr2_pmi : 1;
+value_t ctr3_os : 1;
+value_t ctr3_usr : 1;
+value_t ctr3_any_thread : 1;
+value_t ctr3_pmi : 1;
+value_t reserved0 : 48;
+)
+
+// [SDM 3 20.2.2, 20.2.4]
+define_msr(0x38e, ia32_perf_global_status,
+value_t pmc_overflow : 32;
+value_t fixed_overflow : 4;
+value_t reserved0 : 12;
+value_t perf_metrics_overflow : 1;
+value_t reserved1 : 6;
+value_t topa_pmi : 1;
+value_t reserved2 : 2;
+value_t lbr_frz : 1;
+value_t ctr_frz : 1;
+value_t asci : 1;
+value_t ovf_uncore : 1;
+value_t ovf_ds_buffer : 1;
+value_t cond_changed : 1;
+)
+
+// [SDM 3 20.2.2] writing 1 clears the matching bit of ia32_perf_global_status
+define_msr(0x390, ia32_perf_global_ovf_ctrl,
+value_t clear_pmc_overflow : 32;
+value_t clear_fixed_overflow : 4;
+value_t reserved0 : 12;
+value_t clear_perf_metrics_overflow : 1;
+value_t reserved1 : 6;
+value_t clear_topa_pmi : 1;
+value_t reserved2 : 2;
+value_t clear_lbr_frz : 1;
+value_t clear_ctr_frz : 1;
+value_t reserved3 : 1;
+value_t clear_ovf_uncore : 1;
+value_t clear_ovf_ds_buffer : 1;
+value_t clear_cond_changed : 1;
+)
+
 define_msr(0x480, ia32_vmx_basic,
 value_t vmcs_revision : 31;
 value_t must_be_zero : 1;
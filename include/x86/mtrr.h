@@ -2,6 +2,7 @@
 
 #include "x86/common.h"
 #include "x86/msr.h"
+#include "x86/barrier.h"
 
 namespace x86 {
 namespace mtrr {
@@ -38,7 +39,6 @@ struct fixed_t {
     };
     static_assert(sizeof(value_t) == 8, "sizeof(value_t)");
 
-    // todo: loop read write
     // todo: iterator variable mtrr
 };
 
@@ -87,6 +87,22 @@ using fixed_4k_e8000_t  = fixed_t<0x026d, 0xe8000,  0x1000>;
 using fixed_4k_f0000_t  = fixed_t<0x026e, 0xf0000,  0x1000>;
 using fixed_4k_f8000_t  = fixed_t<0x026f, 0xf8000,  0x1000>;
 
+// all the fixed mtrrs, in the order of the table
+static constexpr msr::id_t fixed_msr_ids[] = {
+        fixed_64k_00000_t::msr_id,
+        fixed_16k_80000_t::msr_id,
+        fixed_16k_a0000_t::msr_id,
+        fixed_4k_c0000_t::msr_id,
+        fixed_4k_c8000_t::msr_id,
+        fixed_4k_d0000_t::msr_id,
+        fixed_4k_d8000_t::msr_id,
+        fixed_4k_e0000_t::msr_id,
+        fixed_4k_e8000_t::msr_id,
+        fixed_4k_f0000_t::msr_id,
+        fixed_4k_f8000_t::msr_id,
+};
+static constexpr size_t fixed_msr_count = sizeof(fixed_msr_ids) / sizeof(fixed_msr_ids[0]);
+
 struct mtrr_cache_t {
     static constexpr size_t max_fixed_mtrr = 16;
     static constexpr size_t max_variable_mtrr = 16;
@@ -131,8 +147,55 @@ static inline variable_mask_t read_variable_mask(size_t offset) {
     return variable_mask_t{.raw = value};
 }
 
+static inline void write_variable_base(size_t offset, const variable_base_t& base) {
+    msr::write(variable_base_msr_id + offset * 2, base.raw);
+}
+
+static inline void write_variable_mask(size_t offset, const variable_mask_t& mask) {
+    msr::write(variable_mask_msr_id + offset * 2, mask.raw);
+}
+
 mtrr_cache_t initialize_cache();
 
+// Writing the MTRRs [SDM 3 11.11.7.2, 11.11.8]
+// the mtrrs of all the cpus must be the same, and are changed by all the cpus together
+// with caching disabled. so a new layout is read or built, and then each cpu calls
+// update() with the same barrier, from an ipi handler for example.
+
+struct range_t {
+    physical_address_t base;
+    uint64_t size;
+    memory_type_t type;
+};
+
+struct layout_t {
+    bool enabled;
+    memory_type_t default_type;
+    bool fixed_enabled;
+    uint64_t fixed[fixed_msr_count];
+    // variable mtrrs of the cpu (ia32_mtrr_cap), the ones after used_count are disabled
+    size_t variable_count;
+    size_t used_count;
+    variable_base_t variable_bases[mtrr_cache_t::max_variable_mtrr];
+    variable_mask_t variable_masks[mtrr_cache_t::max_variable_mtrr];
+};
+
+layout_t read_layout();
+// writes the mtrrs and then ia32_mtrr_def_type, without the cache protocol.
+void write_layout(const layout_t& layout);
+
+// replaces the variable mtrrs of the layout with a small set giving each of the
+// (non overlapping, 4k aligned) ranges its type, and the default type elsewhere.
+// adjacent ranges of the same type are merged first, then each merged range is split
+// greedily into aligned blocks (not always the fewest mtrrs possible).
+// with an UC default, a range may be covered by a larger aligned block and the excess
+// cut out with UC (which takes precedence), which often takes less mtrrs (e.g. 3.5G of
+// WB as 4G WB + 512M UC). fails if more mtrrs are needed than the cpu has.
+bool compute_variable_mtrrs(layout_t& layout, memory_type_t default_type, const range_t* ranges, size_t count);
+
+// call on every cpu with interrupts disabled, barrier.count() must be the number of cpus.
+void update(barrier_t& barrier, const layout_t& layout);
+
 }
 
 template<
@@ -153,4 +216,14 @@ inline mtrr::fixed_t<_msr_id, _base, _size> read() {
     return read<mtrr::fixed_t<_msr_id, _base, _size>>();
 }
 
+template<
+        typename _t,
+        typename meta::enable_if<
+                mtrr::is_fixed_mtrr_def<_t>::value,
+                bool>::type = 0
+>
+inline void write(const typename _t::value_t& value) {
+    msr::write(_t::msr_id, value.raw);
+}
+
 }
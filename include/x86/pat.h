@@ -0,0 +1,71 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/msr.h"
+#include "x86/mtrr.h"
+#include "x86/paging/ia32e.h"
+
+
+namespace x86::pat {
+
+// Page Attribute Table [SDM 3 11.12]
+// the memory type of a page is selected by the pat, pcd and pwt bits of the paging entry
+// which maps it: index = pat << 2 | pcd << 1 | pwt, into the 8 entries of ia32_pat.
+// non-leaf entries have no pat bit, so they (and the tables they point to) can only
+// use entries 0-3. the type from the pat is then combined with the mtrr type of the
+// address [SDM 3 Table 11-7].
+//
+// the power-on layout has no write-combining entry, wc_layout replaces the WT of
+// entry 1 with WC (and keeps entries 0, 2, 3 as they were, so non-leaf entries keep
+// their meaning). the layout must be the same on all the cpus.
+
+static constexpr size_t entries = 8;
+
+// UC-, only valid in the pat (the mtrr type decides between UC and WC)
+static constexpr mtrr::memory_type_t uncached_minus = static_cast<mtrr::memory_type_t>(7);
+
+// [SDM 3 11.12.4 "Table 11-12"]
+static constexpr msr::value_t default_layout = 0x0007040600070406ull;
+// WB, WC, UC-, UC, WB, WP, UC-, WT
+static constexpr msr::value_t wc_layout = 0x0407050600070106ull;
+
+struct entry_bits_t {
+    bool pat;
+    bool pcd;
+    bool pwt;
+
+    size_t index() const;
+    static entry_bits_t from_index(size_t index);
+};
+
+bool is_supported();
+
+mtrr::memory_type_t type_at(msr::value_t layout, size_t index);
+// index of the first entry with the type, false if there is none in the first
+// `limit` entries.
+bool index_of(msr::value_t layout, mtrr::memory_type_t type, size_t& index, size_t limit = entries);
+
+msr::value_t current_layout();
+// writes ia32_pat with the cache flush sequence, call on every cpu with interrupts
+// disabled. fails if the pat isn't supported or a type isn't valid.
+bool install(msr::value_t layout);
+
+// set the pat/pcd/pwt bits of the entry for the type, fails if the layout has no
+// such type (reachable from the entry).
+bool set_memory_type(msr::value_t layout, paging::ia32e::pml4e_t& entry, mtrr::memory_type_t type);
+bool set_memory_type(msr::value_t layout, paging::ia32e::pdpte_t& entry, mtrr::memory_type_t type);
+bool set_memory_type(msr::value_t layout, paging::ia32e::pde_t& entry, mtrr::memory_type_t type);
+bool set_memory_type(msr::value_t layout, paging::ia32e::pte_t& entry, mtrr::memory_type_t type);
+
+// the pat type selected by the entry
+mtrr::memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pml4e_t& entry);
+mtrr::memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pdpte_t& entry);
+mtrr::memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pde_t& entry);
+mtrr::memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pte_t& entry);
+
+// [SDM 3 11.5.2.2 "Table 11-7"] memory_type_invalid if the mtrr type is (the mtrrs
+// of the range overlap with an undefined result).
+mtrr::memory_type_t effective_type(mtrr::memory_type_t mtrr_type, mtrr::memory_type_t pat_type);
+mtrr::memory_type_t effective_type(const mtrr::mtrr_cache_t& mtrrs, physical_address_t address, size_t size, mtrr::memory_type_t pat_type);
+
+}
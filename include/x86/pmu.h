@@ -0,0 +1,177 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/msr.h"
+
+
+namespace x86::pmu {
+
+// Architectural performance monitoring [SDM 3 20.2]
+// general-purpose counters count the event programmed in their perfevtsel, fixed counters
+// each count one predefined event. since version 2, a counter only counts while its bit
+// in ia32_perf_global_ctrl is set, so the counters are programmed once and then started
+// and stopped together.
+// counters are selected by a counter_mask_t, which has the layout of ia32_perf_global_ctrl
+// and ia32_perf_global_status: bit N for general-purpose counter N, bit 32 + N for fixed
+// counter N.
+//
+// for sampling, a counter is preloaded with -period, and raises a PMI through the local
+// apic LVT performance counter entry when it overflows. the LVT entry is masked by the
+// cpu on delivery, and must be unmasked by the handler.
+
+static constexpr msr::id_t perfevtsel_msr_id = 0x186;
+static constexpr msr::id_t pmc_msr_id = 0xc1;
+// full-width alias of the pmc msrs, writes to pmc_msr_id only set bits 31:0 (sign
+// extended) [SDM 3 20.2.6]
+static constexpr msr::id_t full_width_pmc_msr_id = 0x4c1;
+static constexpr msr::id_t perf_capabilities_msr_id = 0x345;
+static constexpr msr::id_t fixed_ctr_msr_id = 0x309;
+
+// rdpmc selects the fixed counters with this bit [SDM 2 "RDPMC"]
+static constexpr uint32_t rdpmc_fixed = bit(30);
+
+static constexpr size_t fixed_counter_base = 32;
+static constexpr size_t max_gp_counters = 32;
+static constexpr size_t max_fixed_counters = 4;
+
+using counter_mask_t = uint64_t;
+
+static constexpr counter_mask_t gp_counter(size_t index) {
+    return bit(index);
+}
+
+static constexpr counter_mask_t fixed_counter(size_t index) {
+    return bit(fixed_counter_base + index);
+}
+
+#pragma pack(push, 1)
+
+// [SDM 3 20.2.1.1]
+struct perfevtsel_t {
+    union {
+        struct {
+            uint64_t event_select : 8;
+            uint64_t umask : 8;
+            uint64_t usr : 1;
+            uint64_t os : 1;
+            uint64_t edge : 1;
+            uint64_t pin_control : 1;
+            uint64_t interrupt : 1;
+            uint64_t any_thread : 1;
+            uint64_t enable : 1;
+            uint64_t invert : 1;
+            uint64_t cmask : 8;
+            uint64_t reserved0 : 32;
+        } bits;
+        uint64_t raw;
+    };
+};
+static_assert(sizeof(perfevtsel_t) == 8, "sizeof(perfevtsel_t)");
+
+#pragma pack(pop)
+
+static constexpr uint8_t not_architectural = 0xff;
+
+struct event_t {
+    uint8_t event_select;
+    uint8_t umask;
+    // bit in cpuid leaf 0xa ebx, which is set if the event is not available
+    uint8_t cpuid_bit;
+};
+
+namespace events {
+
+// [SDM 3 Table 20-1]
+static constexpr event_t core_cycles{0x3c, 0x00, 0};
+static constexpr event_t instructions_retired{0xc0, 0x00, 1};
+static constexpr event_t reference_cycles{0x3c, 0x01, 2};
+static constexpr event_t llc_references{0x2e, 0x4f, 3};
+static constexpr event_t llc_misses{0x2e, 0x41, 4};
+static constexpr event_t branch_instructions_retired{0xc4, 0x00, 5};
+static constexpr event_t branch_misses_retired{0xc5, 0x00, 6};
+static constexpr event_t topdown_slots{0xa4, 0x01, 7};
+
+// model specific (skylake and later), there is no way to check for them
+static constexpr event_t dtlb_load_walks_completed{0x08, 0x0e, not_architectural};
+static constexpr event_t dtlb_store_walks_completed{0x49, 0x0e, not_architectural};
+static constexpr event_t itlb_walks_completed{0x85, 0x0e, not_architectural};
+
+}
+
+// events counted by the fixed counters [SDM 3 20.2.2]
+namespace fixed {
+
+static constexpr size_t instructions_retired = 0;
+static constexpr size_t core_cycles = 1;
+static constexpr size_t reference_cycles = 2;
+static constexpr size_t topdown_slots = 3;
+
+}
+
+enum class count_mode_t : uint8_t {
+    kernel = 1,
+    user = 2,
+    all = 3
+};
+
+struct pmu_info_t {
+    bool loaded;
+    // 0 if not supported
+    uint8_t version;
+    uint8_t gp_count;
+    uint8_t gp_width;
+    uint8_t fixed_count;
+    uint8_t fixed_width;
+    // cpuid leaf 0xa ebx
+    uint32_t unavailable_events;
+    // cpuid leaf 0xa ecx, only valid from version 5
+    uint32_t fixed_mask;
+    // ia32_perf_capabilities.fw_write, without it sampling periods are limited to 2^31
+    bool full_width_writes;
+
+    void load();
+
+    bool is_event_supported(const event_t& event) const;
+    bool is_fixed_supported(size_t index) const;
+    // all the counters which exist
+    counter_mask_t counters() const;
+};
+
+static inline uint64_t rdpmc(uint32_t index) {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index));
+    return low | (static_cast<uint64_t>(high) << 32);
+}
+
+// counters can be read with rdpmc outside ring 0 only if CR4.PCE is set.
+static inline uint64_t read_gp(size_t index) {
+    return rdpmc(static_cast<uint32_t>(index));
+}
+
+static inline uint64_t read_fixed(size_t index) {
+    return rdpmc(rdpmc_fixed | static_cast<uint32_t>(index));
+}
+
+const pmu_info_t& info();
+
+// programs (and enables) the event on the general-purpose counter, it counts once
+// started. fails if the counter or event is not supported.
+bool configure(size_t index, const event_t& event, count_mode_t mode, bool interrupt = false);
+bool configure_fixed(size_t index, count_mode_t mode, bool interrupt = false);
+// disables the counter.
+void reset(size_t index);
+void reset_fixed(size_t index);
+
+// the counters count up, so the next overflow is after period events.
+void set_period(size_t index, uint64_t period);
+void set_fixed_period(size_t index, uint64_t period);
+
+void start(counter_mask_t counters);
+void stop(counter_mask_t counters);
+
+// counters which overflowed since last cleared, call from the PMI handler
+counter_mask_t overflowed();
+void clear_overflow(counter_mask_t counters);
+
+}
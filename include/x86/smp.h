@@ -0,0 +1,82 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/segments.h"
+
+
+namespace x86::smp {
+
+// Multiple-Processor Initialization [SDM 3 8.4]
+// after reset only the bsp runs, the aps wait for an INIT and then a STARTUP ipi,
+// which starts them in real mode at vector << 12 [SDM 3 8.4.4.1].
+// the trampoline copied to that page takes the ap to long mode with the page tables
+// and control registers of the config, loads its gdt/idt, and calls the callback with
+// the index of the ap in the apic ids given to start(), on the stack of that index.
+// all the aps are sent the ipis together, so they wake and run the callback in
+// parallel (e.g. prepare_for_vmxon and vmxon on every cpu at once).
+//
+// INIT doesn't change the apic mode of the aps, they run in the mode firmware left them
+// in (the runtime selected apic functions follow the mode of each cpu). apic ids above
+// 255 can only be targeted in x2apic mode, so with such ids the current cpu must be in
+// x2apic mode [SDM 3 10.12.5].
+// the callbacks run concurrently. start() loads the cpu features database first, the
+// vmx code must call vmx::load_capabilities() before start(), as its lazy load isn't
+// synchronized.
+// when the callback returns, the ap halts with interrupts disabled.
+
+using callback_t = void(*)(size_t cpu, void* context);
+
+// the trampoline page must be in the first 1M, the startup vector is its page number
+static constexpr physical_address_t trampoline_limit = 0x100000;
+// cr3 is loaded before long mode, so it is only 32 bits wide
+static constexpr physical_address_t cr3_limit = 0x100000000ull;
+
+// of the stack pointer on the call to the callback (System V ABI)
+static constexpr size_t stack_alignment = 16;
+
+// [SDM 3 8.4.4.1] delays of the INIT-SIPI-SIPI sequence
+static constexpr uint64_t init_delay_ns = 10000000;
+static constexpr uint64_t startup_delay_ns = 200000;
+// for the aps to reach the callback
+static constexpr uint64_t default_timeout_ns = 100000000;
+
+struct config_t {
+    // 4k page below trampoline_limit, identity mapped in the page tables of cr3
+    physical_address_t trampoline;
+    // 4 level page tables, below cr3_limit
+    physical_address_t cr3;
+    uint64_t cr0;
+    uint64_t cr4;
+    uint64_t efer;
+    segments::table_register_t gdtr;
+    segments::table_register_t idtr;
+    uint16_t code_selector;
+    uint16_t data_selector;
+    // stack_size bytes for each of the apic ids given to start() (that of the current
+    // cpu is unused), stacks and stack_size aligned to stack_alignment
+    void* stacks;
+    size_t stack_size;
+    callback_t callback;
+    void* context;
+    uint64_t timeout_ns;
+};
+
+size_t trampoline_size();
+
+// config with the page tables, control registers, gdt, idt and selectors of the
+// current cpu
+config_t current_config(physical_address_t trampoline, void* stacks, size_t stack_size, callback_t callback, void* context);
+
+// starts the cpus of apic_ids (but the current one) and returns how many reached the
+// callback before the timeout. returns 0 if the config is invalid, count is above
+// topology::max_cpus or an apic id doesn't fit the apic mode of the current cpu.
+// the tsc frequency must be known (tsc::initialize) for the delays. the stacks must
+// fit count cpus. an ap which wakes but isn't in apic_ids halts without a stack.
+size_t start(const config_t& config, const uint32_t* apic_ids, size_t count);
+
+// the ap reached the callback
+bool is_started(size_t cpu);
+// returns once the callback returned on all the started aps
+void wait_for_callbacks();
+
+}
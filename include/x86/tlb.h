@@ -0,0 +1,121 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/paging/paging.h"
+#include "x86/topology.h"
+
+
+namespace x86::tlb {
+
+// TLB invalidation [SDM 3 4.10.4]
+// each cpu only invalidates its own tlb, so a change to paging structures used by other
+// cpus is followed by a shootdown: the initiator posts a request_t to the queue of each
+// target and interrupts it, the targets invalidate and acknowledge, and the initiator
+// waits for all of them.
+// a request gathers many ranges (e.g. from a bulk unmap), merging overlapping and
+// adjacent ones, so the whole batch takes one ipi per target. a target which already
+// has an ipi pending is not sent another one.
+
+// above this many pages, flushing the whole tlb is cheaper than invlpg per page
+static constexpr size_t full_flush_threshold = 32;
+
+static inline void invlpg(linear_address_t address) {
+    asm volatile("invlpg (%0)" : : "r"(address) : "memory");
+}
+
+// flushes the non-global entries (CR3 reload)
+void flush();
+// flushes all entries, including global ones
+void flush_global();
+
+struct range_t {
+    linear_address_t base;
+    size_t pages;
+};
+
+class request_t {
+public:
+    static constexpr size_t max_ranges = 16;
+
+    request_t();
+
+    // pages of 4k from base, merged with the ranges it touches. once there are too many
+    // ranges or pages, the request becomes a full flush.
+    void add(linear_address_t base, size_t pages);
+    void add_all();
+    // the mappings are global, so a full flush must include global entries
+    void set_global(bool global);
+    void reset();
+
+    bool is_full() const;
+    bool is_global() const;
+    size_t pages() const;
+    size_t range_count() const;
+    const range_t& range(size_t index) const;
+
+    // on the current cpu
+    void invalidate() const;
+
+private:
+    range_t m_ranges[max_ranges];
+    size_t m_count;
+    size_t m_pages;
+    bool m_full;
+    bool m_global;
+    // targets which did not acknowledge yet
+    volatile uint32_t m_pending;
+
+    friend class shootdown_t;
+};
+
+// bounded multi-producer single-consumer queue of requests, one per target cpu.
+class queue_t {
+public:
+    static constexpr size_t capacity = 32;
+
+    queue_t();
+
+    // false if full
+    bool push(request_t* request);
+    // nullptr if empty, only called by the owning cpu
+    request_t* pop();
+
+private:
+    struct slot_t {
+        volatile uint64_t sequence;
+        request_t* volatile request;
+    };
+
+    slot_t m_slots[capacity];
+    volatile uint64_t m_enqueue;
+    volatile uint64_t m_dequeue;
+    // an ipi was sent and not yet handled
+    volatile uint32_t m_notified;
+
+    friend class shootdown_t;
+};
+
+// cpus are identified by their index in queues/apic_ids (as in topology::build), the
+// memory is owned by the caller.
+class shootdown_t {
+public:
+    shootdown_t(queue_t* queues, const uint32_t* apic_ids, size_t cpu_count, uint8_t vector);
+
+    // invalidates the request on the target cpus (and on self if it is a target), and
+    // returns once all of them did. while waiting, requests posted to self are handled,
+    // so cpus may shoot each other at the same time. interrupts are disabled for the
+    // duration, so the handler of the vector doesn't run in the middle of it.
+    void flush(size_t self, const topology::cpu_mask_t& targets, request_t& request);
+
+    // call from the handler of the vector on each cpu (and then eoi), with interrupts
+    // disabled.
+    void handle(size_t self);
+
+private:
+    queue_t* m_queues;
+    const uint32_t* m_apic_ids;
+    size_t m_cpu_count;
+    uint8_t m_vector;
+};
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/bitmap.h"
+
+
+namespace x86::topology {
+
+// CPU topology [SDM 3 9.9]
+// the x2apic id of a logical processor is split into fields, from the lowest bits:
+// smt (thread in core), core (in die), die (in package), and package. the width of
+// each field is the same on all the processors of the system, so it is read once
+// with cpuid (0x1f, or 0xb and then the legacy leaves 1/4) on any processor.
+// the x2apic ids of the processors themselves must be collected by the caller, each
+// processor reading its own with current_x2apic_id().
+// caches are shared by the processors whose x2apic ids match above the sharing
+// shift of the cache (leaf 4).
+
+// the masks and per-cpu arrays are sized for this many cpus, define X86_MAX_CPUS (a
+// multiple of 64) to change it.
+#ifdef X86_MAX_CPUS
+static constexpr size_t max_cpus = X86_MAX_CPUS;
+#else
+static constexpr size_t max_cpus = 1024;
+#endif
+static_assert(max_cpus % 64 == 0, "max_cpus must be a multiple of 64");
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0xb/0x1f ecx]
+enum class level_type_t : uint8_t {
+    invalid = 0,
+    smt = 1,
+    core = 2,
+    module = 3,
+    tile = 4,
+    die = 5,
+    die_group = 6
+};
+
+// [SDM 2 "CPUID" Table 3-8, leaf 4 eax]
+enum class cache_type_t : uint8_t {
+    null = 0,
+    data = 1,
+    instruction = 2,
+    unified = 3
+};
+
+// set of cpus, indexed by the position of the cpu in the array given to build().
+struct cpu_mask_t {
+    uint64_t words[max_cpus / bitmap::bits_in_word];
+
+    bool test(size_t cpu) const {
+        return bitmap::test(words, cpu);
+    }
+
+    void set(size_t cpu) {
+        bitmap::set(words, cpu);
+    }
+
+    void clear(size_t cpu) {
+        bitmap::clear(words, cpu);
+    }
+
+    void clear_all() {
+        bitmap::fill(words, sizeof(words) / sizeof(words[0]), false);
+    }
+
+    size_t count() const {
+        size_t count = 0;
+        for (auto word : words) {
+            for (; word != 0; word &= word - 1) {
+                count++;
+            }
+        }
+        return count;
+    }
+};
+
+// the bits of the x2apic id below each level (so the id of the level is
+// x2apic_id >> shift). modules and tiles are folded into the core id.
+struct apic_id_layout_t {
+    uint8_t core_shift;
+    uint8_t die_shift;
+    uint8_t package_shift;
+    // 0 if the cache doesn't exist
+    uint8_t l2_shift;
+    uint8_t l3_shift;
+    bool has_l2;
+    bool has_l3;
+};
+
+struct cpu_topology_t {
+    uint32_t x2apic_id;
+    uint32_t package;
+    // in the package
+    uint32_t die;
+    // in the die
+    uint32_t core;
+    // in the core
+    uint32_t thread;
+    // cpus sharing the cache with this cpu, including itself
+    cpu_mask_t l2_sharing;
+    cpu_mask_t l3_sharing;
+};
+
+// x2apic id of the current cpu, the initial (8 bit) apic id if leaf 0xb isn't supported.
+uint32_t current_x2apic_id();
+
+// reads the layout from cpuid on the current cpu.
+apic_id_layout_t read_layout();
+
+// fills cpus[i] for each of x2apic_ids[i]. fails if count > max_cpus.
+bool build(const apic_id_layout_t& layout, const uint32_t* x2apic_ids, cpu_topology_t* cpus, size_t count);
+
+}
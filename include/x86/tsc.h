@@ -0,0 +1,117 @@
+#pragma once
+
+#include "x86/common.h"
+
+
+namespace x86::tsc {
+
+// Time-Stamp Counter [SDM 3 17.17]
+// rdtsc is not ordered with the instructions around it, so measuring a region takes
+// read_ordered() at the start (waits for the earlier instructions, and the later ones
+// wait for it) and read_tscp() at the end (waits for the region to finish).
+// with an invariant tsc the counter runs at a constant rate in all the p/c-states, so it
+// can be used as a clock, converting cycles to ns with the tsc frequency.
+
+static inline uint64_t read() {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return low | (static_cast<uint64_t>(high) << 32);
+}
+
+static inline uint64_t read_ordered() {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("lfence\n"
+                 "rdtsc\n"
+                 "lfence"
+            : "=a"(low), "=d"(high) : : "memory");
+    return low | (static_cast<uint64_t>(high) << 32);
+}
+
+// aux is ia32_tsc_aux, which the os usually sets to the cpu number.
+static inline uint64_t read_tscp(uint32_t& aux) {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdtscp\n"
+                 "lfence"
+            : "=a"(low), "=d"(high), "=c"(aux) : : "memory");
+    return low | (static_cast<uint64_t>(high) << 32);
+}
+
+static inline uint64_t read_tscp() {
+    uint32_t aux;
+    return read_tscp(aux);
+}
+
+enum class frequency_source_t : uint8_t {
+    none = 0,
+    // cpuid 0x15, crystal clock ratio
+    crystal,
+    // cpuid 0x16, processor base frequency
+    base_frequency,
+    // cpuid 0x40000010, reported by the hypervisor
+    hypervisor,
+    // msr_platform_info, max non-turbo ratio * 100MHz (sandy bridge to kaby lake)
+    platform_info,
+    // measured against a reference clock
+    calibrated
+};
+
+struct frequency_t {
+    uint64_t hz;
+    frequency_source_t source;
+};
+
+bool is_invariant();
+
+// reads the tsc frequency from cpuid or msrs, hz is 0 if none reports it.
+frequency_t discover_frequency();
+
+// measures the tsc frequency against a reference counter of reference_hz, over
+// reference_ticks ticks of it (longer is more accurate). the reference can be anything
+// with a known rate (acpi pm timer, apic timer with a known bus clock, etc), counting up
+// over 64 bits: a narrower counter (the 24 bit pm timer) must be extended by the caller
+// across its wraps. returns 0 if the reference doesn't advance in time.
+uint64_t calibrate(uint64_t (*reference)(), uint64_t reference_hz, uint64_t reference_ticks);
+
+// cycles <-> ns with fixed-point multipliers, so conversions are a multiply and shift.
+class converter_t {
+public:
+    static constexpr size_t shift = 32;
+
+    constexpr converter_t()
+        : m_frequency(0)
+        , m_to_ns(0)
+        , m_to_cycles(0)
+    {}
+    explicit converter_t(uint64_t frequency);
+
+    uint64_t frequency() const;
+
+    uint64_t to_ns(uint64_t cycles) const {
+        return mul_shift(cycles, m_to_ns, shift);
+    }
+
+    uint64_t to_cycles(uint64_t ns) const {
+        return mul_shift(ns, m_to_cycles, shift);
+    }
+
+private:
+    uint64_t m_frequency;
+    // (1e9 << shift) / frequency
+    uint64_t m_to_ns;
+    // (frequency << shift) / 1e9
+    uint64_t m_to_cycles;
+};
+
+// discovers the frequency for the global converter, returns false if it is not known.
+// in which case it should be calibrated and passed to set_frequency.
+bool initialize();
+void set_frequency(const frequency_t& frequency);
+
+const frequency_t& frequency();
+uint64_t to_ns(uint64_t cycles);
+uint64_t to_cycles(uint64_t ns);
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/apic.h"
+#include "x86/paging/paging.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/controls.h"
+#include "x86/vmx/msr_bitmap.h"
+
+
+namespace x86::vmx {
+
+// APIC Virtualization [SDM 3 29]
+// the cpu keeps a virtual-apic page per vcpu (use_tpr_shadow), and with
+// - virtualize_apic_accesses: xapic mmio accesses go to the virtual-apic page
+//   (through the apic-access page address)
+// - virtualize_x2apic: x2apic msr accesses go to the virtual-apic page (with msr bitmaps)
+// - apic_register_virtualization: most reads are satisfied without a vmexit
+// - virtual_interrupt_delivery: the cpu evaluates and delivers pending virtual
+//   interrupts (from the irr) and handles eoi. pending/in-service vectors
+//   are tracked by guest_interrupt_status (RVI/SVI).
+// so tpr/eoi/self-ipi traffic doesn't cause apic_access/apic_write exits.
+
+#pragma pack(push, 1)
+
+// [SDM 3 29.1]
+struct virtual_apic_page_t {
+    volatile uint8_t data[x86::paging::page_size_4k];
+
+    uint32_t read(apic::register_t reg) const;
+    void write(apic::register_t reg, uint32_t value);
+
+    uint8_t tpr() const;
+    void tpr(uint8_t value);
+
+    bool test_irr(uint8_t vector) const;
+    void set_irr(uint8_t vector);
+    void clear_irr(uint8_t vector);
+
+    bool test_isr(uint8_t vector) const;
+
+    // ORs the requests (a 256 bit vector bitmap) into the irr,
+    // e.g. posted_interrupt_descriptor_t::harvest() output.
+    void merge_irr(const uint64_t (&requests)[4]);
+
+    // highest vector set, or -1 if none.
+    int highest_irr() const;
+    int highest_isr() const;
+};
+static_assert(sizeof(virtual_apic_page_t) == x86::paging::page_size_4k, "sizeof(virtual_apic_page_t)");
+
+// [SDM 3 24.4.2 "Guest Interrupt Status"]
+struct guest_interrupt_status_t {
+    union {
+        struct {
+            uint16_t rvi : 8; // requesting virtual interrupt
+            uint16_t svi : 8; // servicing virtual interrupt
+        } bits;
+        uint16_t raw;
+    };
+};
+static_assert(sizeof(guest_interrupt_status_t) == 2, "sizeof(guest_interrupt_status_t)");
+
+// [SDM 3 24.6.8]
+// a set bit makes an eoi for the vector a vmexit (virtualized_eoi),
+// e.g. for level triggered interrupts which need an eoi to the io-apic.
+struct eoi_exit_bitmap_t {
+    uint64_t words[4];
+
+    void clear_all();
+    void set(uint8_t vector);
+    void clear(uint8_t vector);
+    bool test(uint8_t vector) const;
+
+    instruction_result_t write_to_vmcs() const;
+};
+static_assert(sizeof(eoi_exit_bitmap_t) == 32, "sizeof(eoi_exit_bitmap_t)");
+
+#pragma pack(pop)
+
+// use_tpr_shadow, apic_register_virtualization, virtual_interrupt_delivery
+// and external_interrupt_exiting (required by virtual interrupt delivery), with
+// virtualize_x2apic or virtualize_apic_accesses according to the guest apic mode.
+void enable_apic_virtualization(pin_based_exec_controls_t& pin_based,
+                                processor_based_exec_controls_t& controls,
+                                secondary_processor_based_exec_controls_t& secondary,
+                                bool x2apic);
+
+// for virtualize_x2apic: pass through reads of the x2apic msrs and writes of tpr, eoi and self-ipi,
+// which are then handled on the virtual-apic page.
+bool passthrough_virtualized_x2apic(msr_bitmap_t& bitmap);
+
+instruction_result_t set_virtual_apic_address(physical_address_t address);
+// only used with virtualize_apic_accesses
+instruction_result_t set_apic_access_address(physical_address_t address);
+
+instruction_result_t read_guest_interrupt_status(guest_interrupt_status_t& status);
+instruction_result_t write_guest_interrupt_status(const guest_interrupt_status_t& status);
+
+// sets RVI to the highest vector in the virtual irr, so that the cpu delivers it
+// on vmentry. to be used after setting irr bits by software.
+instruction_result_t update_rvi(const virtual_apic_page_t& page);
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/msr.h"
+
+
+namespace x86::vmx {
+
+// VMX Capability Reporting Facility [SDM 3 Appendix A]
+// the capability msrs are 0x480 - 0x491 and don't change after boot, so they are
+// read once into this snapshot. every vmx helper consults the snapshot, which
+// saves an rdmsr per query (a vmexit each when running nested).
+// msrs which don't exist on the cpu (per the rules in Appendix A) are left as 0.
+
+static constexpr msr::id_t capabilities_first_msr = 0x480;
+static constexpr msr::id_t capabilities_last_msr = 0x491;
+
+struct capabilities_t {
+    static constexpr size_t msr_count = capabilities_last_msr - capabilities_first_msr + 1;
+
+    msr::value_t msrs[msr_count];
+    bool loaded;
+
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    _msr get() const {
+        static_assert(_msr::id >= capabilities_first_msr && _msr::id <= capabilities_last_msr,
+                "not a vmx capability msr");
+        return _msr(msrs[_msr::id - capabilities_first_msr]);
+    }
+
+    msr::ia32_vmx_basic_t basic() const { return get<msr::ia32_vmx_basic_t>(); }
+    msr::ia32_vmx_misc_t misc() const { return get<msr::ia32_vmx_misc_t>(); }
+    msr::ia32_vmx_ept_vpid_cap_t ept_vpid_cap() const { return get<msr::ia32_vmx_ept_vpid_cap_t>(); }
+    msr::ia32_vmx_vmfunc_t vmfunc() const { return get<msr::ia32_vmx_vmfunc_t>(); }
+
+    bool are_true_controls_supported() const;
+    bool are_secondary_controls_supported() const;
+};
+
+// reads the capability msrs. should be called once (e.g. on the bsp before starting
+// the other cpus), otherwise it is done on the first call to capabilities(). that lazy
+// load isn't synchronized, so it must be done before cpus use the snapshot concurrently.
+void load_capabilities();
+
+const capabilities_t& capabilities();
+
+}
@@ -3,6 +3,7 @@
 #include "x86/common.h"
 #include "x86/msr.h"
 #include "x86/vmx/vmcs.h"
+#include "x86/vmx/capabilities.h"
 
 namespace x86::vmx {
 
@@ -116,9 +117,11 @@ struct secondary_processor_based_exec_controls_t :
             uint32_t ept_violation_ve : 1;
             uint32_t conceal_vmx_non_root_from_ipt : 1;
             uint32_t enable_xsaves_xstors : 1;
+            uint32_t unused0 : 1;
             uint32_t mode_based_execution_control : 1;
+            uint32_t unused1 : 2;
             uint32_t use_tsc_scaling : 1;
-            uint32_t unused0 : 6;
+            uint32_t unused2 : 6;
         } bits;
         uint32_t raw;
     };
@@ -191,19 +194,20 @@ struct controls_allowed_t {
 };
 
 static inline bool are_true_allowed_msr_supported() {
-    const auto msr = x86::read<msr::ia32_vmx_basic_t>();
-    return msr.bits.vm_ctrls_fixed != 0;
+    return capabilities().are_true_controls_supported();
 }
 
 template<typename _controls>
 static inline controls_allowed_t get_controls_allowed() {
+    const auto& caps = capabilities();
+
     controls_allowed_t result{};
-    if (are_true_allowed_msr_supported()) {
-        auto allowed = x86::read<typename _controls::allowed_true_msr>();
+    if (caps.are_true_controls_supported()) {
+        auto allowed = caps.get<typename _controls::allowed_true_msr>();
         result.allowed0 = allowed.bits.allowed0;
         result.allowed1 = allowed.bits.allowed1;
     } else {
-        auto allowed = x86::read<typename _controls::allowed_msr>();
+        auto allowed = caps.get<typename _controls::allowed_msr>();
         result.allowed0 = allowed.bits.allowed0;
         result.allowed1 = allowed.bits.allowed1;
     }
@@ -4,6 +4,10 @@
 #include "x86/vmx/error.h"
 #include "x86/mtrr.h"
 
+#ifdef X86_VMX_MOCK
+#include "x86/vmx/mock.h"
+#endif
+
 
 namespace x86::vmx {
 
@@ -227,20 +231,28 @@ static_assert(sizeof(invvpid_descriptor_t) == 16, "sizeof(invvpid_descriptor_t)"
 
 bool to_physical(ept_pointer_t& eptp, guest_physical_address_t address, physical_address_t& out);
 
-static inline instruction_result_t invept(invept_type_t type, invept_descriptor_t descriptor = {}) {
+static inline instruction_result_t invept(invept_type_t type, [[maybe_unused]] invept_descriptor_t descriptor = {}) {
+#ifdef X86_VMX_MOCK
+    return mock::invept(static_cast<uint64_t>(type));
+#else
     auto error = instruction_result_t::success;
     asm volatile("invept %1, %2\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : "m" (descriptor), "r"(type) : "memory");
     return error;
+#endif
 }
 
-static inline instruction_result_t invvpid(invept_type_t type, invvpid_descriptor_t descriptor = {}) {
+static inline instruction_result_t invvpid(invept_type_t type, [[maybe_unused]] invvpid_descriptor_t descriptor = {}) {
+#ifdef X86_VMX_MOCK
+    return mock::invvpid(static_cast<uint64_t>(type));
+#else
     auto error = instruction_result_t::success;
     asm volatile("invvpid %1, %2\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : "m" (descriptor), "r"(type) : "memory");
     return error;
+#endif
 }
 
 }
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/cpuid.h"
+
+
+namespace x86::vmx {
+
+// Precomputed cpuid values for a guest, for handling cpuid vmexits [SDM 3 25.1.2].
+// built once per vm from the host leaves and a policy, after which a lookup is a couple
+// of table indexes, without executing cpuid on the host or re-applying the policy.
+// only the values which are different per vcpu or depend on guest state (apic id,
+// OSXSAVE) are patched on lookup.
+//
+// leaves are kept in 3 ranges: basic (0x0 - 0x1f), hypervisor (0x40000000 - 0x4000000f)
+// and extended (0x80000000 - 0x8000001f). like the cpu does, a leaf above the max leaf
+// of its range returns the values of the highest basic leaf [SDM 2 "CPUID"].
+
+static constexpr cpuid_t guest_cpuid_basic_first = 0x0;
+static constexpr cpuid_t guest_cpuid_hypervisor_first = 0x40000000;
+static constexpr cpuid_t guest_cpuid_extended_first = 0x80000000;
+
+struct guest_cpuid_policy_t {
+    // clears CPUID.1:ECX.VMX, nested virtualization isn't offered.
+    bool hide_vmx;
+
+    // sets CPUID.1:ECX[31] and reports the hypervisor leaves:
+    // 0x40000000: eax = max hypervisor leaf, ebx:ecx:edx = signature
+    // leaves after it (up to hypervisor_max_leaf) are 0 until set with set().
+    bool hypervisor_leaves;
+    cpuid_t hypervisor_max_leaf;
+    uint32_t hypervisor_signature[3];
+
+    // presents the vcpus as cores of a single package with one thread each (leaves 1, 4,
+    // 0xb, 0x1f). 0 keeps the host topology.
+    uint32_t vcpu_count;
+
+    // limits for the max leaves (0 keeps the host max).
+    cpuid_t max_basic_leaf;
+    cpuid_t max_extended_leaf;
+};
+
+// guest state which the values depend on
+struct guest_cpuid_state_t {
+    uint32_t apic_id;
+    // CR4.OSXSAVE of the guest
+    bool osxsave;
+};
+
+class guest_cpuid_t {
+public:
+    static constexpr size_t basic_leaves = 0x20;
+    static constexpr size_t hypervisor_leaves = 0x10;
+    static constexpr size_t extended_leaves = 0x20;
+    static constexpr size_t max_entries = 256;
+
+    guest_cpuid_t();
+
+    // reads the host leaves and applies the policy. returns false if the host
+    // leaves didn't fit in the table.
+    bool build(const guest_cpuid_policy_t& policy);
+
+    // overrides the values of a leaf/subleaf which is in the table.
+    // used for changes not covered by the policy (e.g. masking other features).
+    bool set(cpuid_t leaf, cpuid_t subleaf, const cpuid_regs_t& regs);
+
+    // returns the values for the guest, for use in the cpuid vmexit handler.
+    cpuid_regs_t lookup(cpuid_t leaf, cpuid_t subleaf, const guest_cpuid_state_t& state) const;
+
+private:
+    static constexpr size_t slot_count = basic_leaves + hypervisor_leaves + extended_leaves;
+
+    struct slot_t {
+        uint16_t first;
+        uint8_t count;
+        bool indexed;
+    };
+
+    bool add_leaf(cpuid_t leaf);
+    bool add_leaf(cpuid_t leaf, const cpuid_regs_t* subleaves, size_t count, bool indexed);
+    cpuid_regs_t* find(cpuid_t leaf, cpuid_t subleaf);
+    bool contains(cpuid_t leaf) const;
+    // leaves not in the table map to the slot of the max basic leaf
+    size_t slot_of(cpuid_t leaf) const;
+
+    void apply_features(const guest_cpuid_policy_t& policy);
+    void apply_hypervisor(const guest_cpuid_policy_t& policy);
+    void apply_topology(const guest_cpuid_policy_t& policy);
+
+    slot_t m_slots[slot_count];
+    cpuid_regs_t m_entries[max_entries];
+    size_t m_entry_count;
+    cpuid_t m_max_basic;
+    cpuid_t m_max_hypervisor;
+    cpuid_t m_max_extended;
+};
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/bitmap.h"
+#include "x86/paging/paging.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/controls.h"
+
+
+namespace x86::vmx {
+
+// I/O Bitmaps [SDM 3 24.6.4]
+// used when processor_based_exec_controls_t.use_io_bitmaps = 1.
+// two 4k bitmaps, a set bit means the access to the port causes a vmexit.
+// - bitmap a: ports 0x0000 - 0x7fff
+// - bitmap b: ports 0x8000 - 0xffff
+// an access of N bytes to port P exits if any of the bits for P..P+N-1 is set,
+// and always exits if it wraps around 0xffff [SDM 3 25.1.3].
+// each bitmap must be 4k aligned, they are placed here one after the other,
+// so aligning io_bitmap_t to 4k is enough.
+// passing through noisy ports which the guest may own (e.g. serial 0x3f8-0x3ff,
+// pit 0x40-0x43) removes an exit per access.
+
+using port_t = uint16_t;
+
+static constexpr size_t io_bitmap_ports_in_bitmap = 0x8000;
+static constexpr size_t io_bitmap_port_count = 0x10000;
+
+#pragma pack(push, 1)
+
+struct io_bitmap_t {
+    static constexpr size_t words_in_bitmap = io_bitmap_ports_in_bitmap / bitmap::bits_in_word;
+
+    uint64_t a[words_in_bitmap];
+    uint64_t b[words_in_bitmap];
+
+    void intercept_all();
+    void passthrough_all();
+
+    void intercept(port_t port);
+    void passthrough(port_t port);
+
+    // ranges are inclusive and may cross from bitmap a to b.
+    void intercept(port_t first, port_t last);
+    void passthrough(port_t first, port_t last);
+
+    bool is_intercepted(port_t port, size_t access_size = 1) const;
+
+    // checked a word at a time
+    bool is_all_intercepted() const;
+    bool is_all_passthrough() const;
+
+    // Picks the cheapest way to get the exits this bitmap describes:
+    // - everything intercepted: unconditional_io_exiting = 1, use_io_bitmaps = 0,
+    //   no bitmap lookups are needed for exiting.
+    // - nothing intercepted: both off, i/o never exits.
+    // - otherwise: use_io_bitmaps = 1. unconditional_io_exiting is ignored by the
+    //   cpu in this case [SDM 3 24.6.2 "Table 24-6"], and is cleared to make that explicit.
+    void configure_controls(processor_based_exec_controls_t& controls) const;
+};
+static_assert(sizeof(io_bitmap_t) == x86::paging::page_size_4k * 2, "sizeof(io_bitmap_t)");
+
+#pragma pack(pop)
+
+static inline instruction_result_t set_io_bitmap_addresses(physical_address_t bitmap_a, physical_address_t bitmap_b) {
+    auto result = vmwrite(field_t::ctrl_io_bitmap_a_address, bitmap_a);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    return vmwrite(field_t::ctrl_io_bitmap_b_address, bitmap_b);
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/error.h"
+
+
+namespace x86::vmx {
+
+struct capabilities_t;
+
+}
+
+namespace x86::vmx::mock {
+
+// Software model of the vmx instructions, for running vmx code outside of vmx root
+// operation (e.g. hosted tests and benchmarks of exit handling).
+// when X86_VMX_MOCK is defined, the vmx instruction wrappers (vmxon, vmxoff, vmclear,
+// vmptrld, vmptrst, vmread, vmwrite, vmlaunch, vmresume, invept, invvpid) call into
+// this model instead of executing the instructions, and the capability snapshot is
+// filled with permissive values (no control is fixed, every control is allowed).
+// anything else (msrs, control registers, cpuid) is not modelled.
+//
+// physical addresses given to the instructions are treated as host pointers. the vmcs
+// data (fields and launch state) is kept inside the vmcs region itself, so any number
+// of vmcs can be used, like with the real instructions. the model is of a single cpu.
+//
+// checks follow [SDM 3 30.3] for the modelled parts: VMfailInvalid without a current
+// vmcs (or outside vmx operation), VMfailValid with vm_instruction_error set in the
+// current vmcs otherwise.
+// vmlaunch/vmresume that succeed mark the vmcs as launched and return success right
+// away, as if an immediate vmexit happened. exit information can be then written with
+// set_field (which, unlike vmwrite, may write read-only fields).
+
+static constexpr uint32_t vmcs_revision = 1;
+
+struct stats_t {
+    uint64_t vmclear;
+    uint64_t vmptrld;
+    uint64_t vmptrst;
+    uint64_t vmread;
+    uint64_t vmwrite;
+    uint64_t vmlaunch;
+    uint64_t vmresume;
+    uint64_t invept;
+    uint64_t invvpid;
+};
+
+// leaves vmx operation and clears the stats.
+void reset();
+const stats_t& stats();
+
+bool set_field(uint32_t field, uint64_t value);
+
+void fill_capabilities(capabilities_t& caps);
+
+instruction_result_t vmxon(physical_address_t address);
+instruction_result_t vmxoff();
+instruction_result_t vmclear(physical_address_t address);
+instruction_result_t vmptrld(physical_address_t address);
+instruction_result_t vmptrst(physical_address_t& address);
+instruction_result_t vmread(uint32_t field, uint64_t& value);
+instruction_result_t vmwrite(uint32_t field, uint64_t value);
+instruction_result_t vmlaunch();
+instruction_result_t vmresume();
+instruction_result_t invept(uint64_t type);
+instruction_result_t invvpid(uint64_t type);
+
+}
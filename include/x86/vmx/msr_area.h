@@ -0,0 +1,108 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/msr.h"
+#include "x86/paging/paging.h"
+#include "x86/vmx/vmcs.h"
+
+
+namespace x86::vmx {
+
+// VM-Exit/VM-Entry MSR areas [SDM 3 24.7.2, 24.8.2]
+// - vmexit msr-store: guest values are stored here on vmexit
+// - vmexit msr-load: host values are loaded from here on vmexit
+// - vmentry msr-load: guest values are loaded from here on vmentry
+// each area is an array of 16 byte entries, 16 byte aligned.
+// the cpu processes the areas in order, so keeping them short matters.
+
+#pragma pack(push, 1)
+
+// [SDM 3 24.7.2 "Table 24-11"]
+struct msr_entry_t {
+    msr::id_t index;
+    uint32_t reserved;
+    msr::value_t data;
+};
+static_assert(sizeof(msr_entry_t) == 16, "sizeof(msr_entry_t)");
+
+// a 4k page of entries, should be 4k aligned.
+struct msr_area_t {
+    msr_entry_t entries[x86::paging::page_size_4k / sizeof(msr_entry_t)];
+};
+static_assert(sizeof(msr_area_t) == x86::paging::page_size_4k, "sizeof(msr_area_t)");
+
+#pragma pack(pop)
+
+// [SDM 3 A.6] 512 * (IA32_VMX_MISC[27:25] + 1)
+size_t max_recommended_msr_area_count();
+
+// msrs which may not be placed in the load areas [SDM 3 26.4, 27.4]:
+// fs/gs base (which have their own vmcs fields), the x2apic range,
+// IA32_SMM_MONITOR_CTL and IA32_SMBASE.
+bool is_msr_allowed_in_area(msr::id_t id);
+
+// Manages an msr switch list for a single vmcs.
+// the guest area is used both as the vmentry msr-load area and the vmexit
+// msr-store area, so guest values saved on exit are reloaded on the next entry.
+// the host area is the vmexit msr-load area.
+// while attached (after attach() on the current vmcs), add/remove keep
+// the vmcs counts in sync.
+class msr_switch_t {
+public:
+    msr_switch_t(msr_area_t& guest_area, msr_area_t& host_area);
+
+    size_t count() const;
+    size_t capacity() const;
+
+    bool contains(msr::id_t id) const;
+
+    bool add(msr::id_t id, msr::value_t guest_value, msr::value_t host_value);
+    bool remove(msr::id_t id);
+
+    // guest value as stored on the last vmexit (or as last set)
+    bool guest_value(msr::id_t id, msr::value_t& value) const;
+    bool set_guest_value(msr::id_t id, msr::value_t value);
+    bool set_host_value(msr::id_t id, msr::value_t value);
+
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool add(const _msr& guest_value, const _msr& host_value) {
+        return add(_msr::id, guest_value.raw, host_value.raw);
+    }
+
+    // host value is the current value of the msr
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool add(const _msr& guest_value) {
+        return add(guest_value, x86::read<_msr>());
+    }
+
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool remove() {
+        return remove(_msr::id);
+    }
+
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool contains() const {
+        return contains(_msr::id);
+    }
+
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool guest_value(_msr& value) const {
+        return guest_value(_msr::id, value.raw);
+    }
+
+    // writes the area addresses and counts into the current vmcs
+    instruction_result_t attach(physical_address_t guest_area_address, physical_address_t host_area_address);
+    void detach();
+
+private:
+    size_t find(msr::id_t id) const;
+    instruction_result_t write_counts() const;
+
+    msr_area_t& m_guest_area;
+    msr_area_t& m_host_area;
+    size_t m_count;
+    size_t m_capacity;
+    bool m_attached;
+};
+
+}
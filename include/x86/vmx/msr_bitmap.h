@@ -0,0 +1,95 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/msr.h"
+#include "x86/bitmap.h"
+#include "x86/paging/paging.h"
+#include "x86/vmx/vmcs.h"
+
+
+namespace x86::vmx {
+
+// MSR Bitmaps [SDM 3 24.6.9]
+// used when processor_based_exec_controls_t.use_msr_bitmaps = 1.
+// a 4k region made of 4 1k bitmaps, a set bit means the access causes a vmexit.
+// - read low: msrs 0x00000000 - 0x00001fff
+// - read high: msrs 0xc0000000 - 0xc0001fff
+// - write low: msrs 0x00000000 - 0x00001fff
+// - write high: msrs 0xc0000000 - 0xc0001fff
+// accesses to msrs outside those ranges always cause a vmexit.
+// the bitmap must be 4k aligned.
+
+static constexpr msr::id_t msr_bitmap_low_first = 0x00000000;
+static constexpr msr::id_t msr_bitmap_low_last = 0x00001fff;
+static constexpr msr::id_t msr_bitmap_high_first = 0xc0000000;
+static constexpr msr::id_t msr_bitmap_high_last = 0xc0001fff;
+static constexpr size_t msr_bitmap_msrs_in_range = 0x2000;
+
+#pragma pack(push, 1)
+
+struct msr_bitmap_t {
+    static constexpr size_t words_in_range = msr_bitmap_msrs_in_range / bitmap::bits_in_word;
+
+    uint64_t read_low[words_in_range];
+    uint64_t read_high[words_in_range];
+    uint64_t write_low[words_in_range];
+    uint64_t write_high[words_in_range];
+
+    static bool is_in_bitmap(msr::id_t id);
+
+    void intercept_all();
+    void passthrough_all();
+
+    bool intercept_read(msr::id_t id);
+    bool intercept_write(msr::id_t id);
+    bool intercept(msr::id_t id);
+    bool passthrough_read(msr::id_t id);
+    bool passthrough_write(msr::id_t id);
+    bool passthrough(msr::id_t id);
+
+    // ranges are inclusive and must be within the same bitmap range (low/high).
+    bool intercept_read(msr::id_t first, msr::id_t last);
+    bool intercept_write(msr::id_t first, msr::id_t last);
+    bool intercept(msr::id_t first, msr::id_t last);
+    bool passthrough_read(msr::id_t first, msr::id_t last);
+    bool passthrough_write(msr::id_t first, msr::id_t last);
+    bool passthrough(msr::id_t first, msr::id_t last);
+
+    bool is_read_intercepted(msr::id_t id) const;
+    bool is_write_intercepted(msr::id_t id) const;
+
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool intercept_read() { return intercept_read(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool intercept_write() { return intercept_write(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool intercept() { return intercept(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool passthrough_read() { return passthrough_read(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool passthrough_write() { return passthrough_write(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool passthrough() { return passthrough(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool is_read_intercepted() const { return is_read_intercepted(_msr::id); }
+    template<typename _msr, typename meta::enable_if<msr::is_msr_def<_msr>::value, bool>::type = 0>
+    bool is_write_intercepted() const { return is_write_intercepted(_msr::id); }
+
+    // preset: nothing exits except accesses (read and write) to the given msrs.
+    // e.g. bitmap.passthrough_all_except<msr::ia32_efer_t, msr::ia32_apic_base_t>();
+    template<typename... _msrs>
+    void passthrough_all_except() {
+        passthrough_all();
+        (intercept<_msrs>(), ...);
+    }
+};
+static_assert(sizeof(msr_bitmap_t) == x86::paging::page_size_4k, "sizeof(msr_bitmap_t)");
+
+#pragma pack(pop)
+
+// processor_based_exec_controls_t.use_msr_bitmaps should be set as well.
+static inline instruction_result_t set_msr_bitmap_address(physical_address_t address) {
+    return vmwrite(field_t::ctrl_msr_bitmap_address, address);
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/controls.h"
+
+
+namespace x86::vmx {
+
+// Negotiation of vm-execution/exit/entry controls from a set of wanted features.
+// the caller declares the features it requires and the ones it prefers, and gets
+// the best consistent set of controls the cpu supports, along with a report of
+// what couldn't be enabled. features auto-enable the features and controls they
+// depend on (e.g. posted_interrupts -> virtual_interrupt_delivery -> tpr_shadow,
+// and activate_secondary_controls for any secondary control).
+
+// ordered so that a feature comes after the features it depends on
+enum class feature_t : uint32_t {
+    tpr_shadow,
+    ept,
+    vpid,
+    unrestricted_guest,
+    pml,
+    tsc_offsetting,
+    tsc_scaling,
+    rdtscp,
+    msr_bitmaps,
+    io_bitmaps,
+    preemption_timer,
+    virtualize_x2apic,
+    apic_register_virtualization,
+    virtual_interrupt_delivery,
+    posted_interrupts,
+    vmcs_shadowing,
+    invpcid,
+    xsaves,
+    pause_loop_exiting,
+
+    count
+};
+
+struct features_t {
+    uint32_t raw;
+
+    bool has(feature_t feature) const { return (raw & bit(static_cast<uint32_t>(feature))) != 0; }
+    features_t& set(feature_t feature) { raw |= bit(static_cast<uint32_t>(feature)); return *this; }
+    features_t& clear(feature_t feature) { raw &= ~bit(static_cast<uint32_t>(feature)); return *this; }
+    bool empty() const { return raw == 0; }
+};
+
+struct feature_profile_t {
+    features_t required;
+    features_t preferred;
+};
+
+struct negotiated_controls_t {
+    pin_based_exec_controls_t pin_based;
+    processor_based_exec_controls_t processor_based;
+    secondary_processor_based_exec_controls_t secondary_processor_based;
+    vmexit_controls_t vmexit;
+    vmentery_controls_t vmentry;
+
+    features_t enabled;
+    // preferred features (or their dependencies) which aren't supported
+    features_t fallen_back;
+    // required features (or their dependencies) which aren't supported
+    features_t missing;
+};
+
+// controls in result which are already set (e.g. host_address_space_size, hlt_exiting)
+// are kept, feature controls are added, and all are then adjusted with adjust_vm_controls.
+// returns false if a required feature is missing.
+bool negotiate_controls(const feature_profile_t& profile, negotiated_controls_t& result);
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/controls.h"
+
+
+namespace x86::vmx {
+
+// PAUSE-Loop Exiting [SDM 3 25.1.3, 24.6.13]
+// with secondary pause_loop_exiting, a pause in cpl 0 causes a vmexit (pause) when
+// the guest has been spinning in a pause loop for longer than ple_window tsc ticks,
+// where pauses at most ple_gap ticks apart are considered part of the same loop.
+// a small window exits early, which is good when the lock holder vcpu is preempted
+// (the spinner should give the cpu to it), but causes needless exits when it isn't.
+
+struct ple_config_t {
+    uint32_t gap;
+    uint32_t min_window;
+    uint32_t max_window;
+    uint32_t grow_factor;
+    // 0 is taken as 1
+    uint32_t shrink_factor;
+    // window for measuring the pause exit rate, in tsc ticks. 0 is taken as 1
+    uint64_t sample_period;
+    // pause exits in a sample period (with nothing to yield to) before the window grows
+    uint32_t grow_threshold;
+};
+
+static constexpr ple_config_t default_ple_config = {
+        .gap = 128,
+        .min_window = 4096,
+        .max_window = 4096 * 16,
+        .grow_factor = 2,
+        .shrink_factor = 2,
+        .sample_period = 1000000,
+        .grow_threshold = 4,
+};
+
+// secondary pause_loop_exiting on, and no pause_exiting (which exits on every pause)
+void enable_pause_loop_exiting(processor_based_exec_controls_t& controls,
+                               secondary_processor_based_exec_controls_t& secondary);
+
+// Per-vcpu adaptive ple window.
+// on each pause exit, if there is another vcpu to run on this cpu the spinner is
+// likely waiting for a preempted one, so the window shrinks and a yield is advised.
+// otherwise the exit was for nothing, and repeated ones in the same sample
+// period grow the window.
+class ple_controller_t {
+public:
+    explicit ple_controller_t(const ple_config_t& config = default_ple_config);
+
+    uint32_t window() const;
+    // pause exits in the last complete sample period
+    uint32_t exit_rate() const;
+
+    // call on exit_reason_t::pause. can_yield is whether another vcpu is runnable on
+    // this cpu (e.g. timeslice_scheduler_t::has_other_runnable()). returns true if the
+    // vcpu should yield (e.g. timeslice_scheduler_t::yield()).
+    bool on_pause_exit(uint64_t tsc, bool can_yield);
+
+    // writes gap and window into the current vmcs, when they changed since the last write
+    instruction_result_t write_to_vmcs();
+
+private:
+    void sample(uint64_t tsc);
+    void window(uint64_t value);
+
+    ple_config_t m_config;
+    uint32_t m_window;
+    uint64_t m_period_start;
+    uint32_t m_exits_in_period;
+    uint32_t m_exit_rate;
+    bool m_dirty;
+};
+
+}
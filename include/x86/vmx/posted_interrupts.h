@@ -0,0 +1,76 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/controls.h"
+
+
+namespace x86::vmx {
+
+// Posted-Interrupt Processing [SDM 3 29.6]
+// with process_posted_interrupts, an external interrupt with the notification
+// vector arriving while the guest runs is not a vmexit, instead the cpu moves the
+// posted-interrupt requests (PIR) into the virtual-apic page and delivers them.
+// requires external_interrupt_exiting, acknowledge_interrupt_on_exit and
+// virtual_interrupt_delivery.
+//
+// posting an interrupt to a vcpu:
+//  - set the vector in the PIR
+//  - set ON (outstanding notification), unless already set or SN (suppress notification)
+//  - if ON was set by us, send the notification vector to the cpu running the vcpu
+// when the vcpu isn't running the PIR is left as is, and is moved into the
+// virtual-apic page on the next vmentry (see harvest()).
+
+#pragma pack(push, 1)
+
+// [SDM 3 29.6 "Table 29-1"]
+struct posted_interrupt_descriptor_t {
+    union control_t {
+        struct {
+            uint64_t on : 1;
+            uint64_t sn : 1;
+            uint64_t reserved0 : 14;
+            uint64_t nv : 8;
+            uint64_t reserved1 : 8;
+            uint64_t ndst : 32;
+        } bits;
+        uint64_t raw;
+    };
+
+    volatile uint64_t pir[4];
+    volatile uint64_t control;
+    uint64_t reserved[3];
+
+    control_t read_control() const;
+
+    // notification vector and destination (apic id of the cpu running the vcpu)
+    void notification(uint8_t vector, uint32_t apic_id, bool x2apic);
+    void suppress_notifications(bool suppress);
+
+    // lock-free, may be called from any cpu. returns true if a notification
+    // should be sent.
+    bool post(uint8_t vector);
+    // post() and send the notification if needed.
+    void post_and_notify(uint8_t vector, bool x2apic);
+
+    bool test_and_clear_on();
+    bool is_pending() const;
+
+    // atomically moves the pending requests out of the PIR, for delivering
+    // them by software (e.g. into the virtual-apic irr) when the vcpu isn't running.
+    // returns true if any request was pending.
+    bool harvest(uint64_t (&requests)[4]);
+} __attribute__((aligned(64)));
+static_assert(sizeof(posted_interrupt_descriptor_t) == 64, "sizeof(posted_interrupt_descriptor_t)");
+static_assert(alignof(posted_interrupt_descriptor_t) == 64, "alignof(posted_interrupt_descriptor_t)");
+
+#pragma pack(pop)
+
+// processor_based_exec_controls_t.activate_secondary_controls is needed for the secondary controls.
+void enable_posted_interrupts(pin_based_exec_controls_t& pin_based,
+                              secondary_processor_based_exec_controls_t& secondary,
+                              vmexit_controls_t& vmexit);
+
+instruction_result_t set_posted_interrupts(uint8_t notification_vector, physical_address_t descriptor_address);
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/vmexit.h"
+#include "x86/vmx/controls.h"
+
+
+namespace x86::vmx {
+
+// VMX-Preemption Timer [SDM 3 25.5.1]
+// counts down while in vmx non-root, at a rate of TSC >> IA32_VMX_MISC[4:0].
+// when it reaches 0 a vmexit with vmx_preemption_timer_expired occurs.
+// with vmexit_controls_t.save_preemption_timer_value the remaining value
+// is saved into guest_vmx_preemption_timer_value on every vmexit.
+
+static constexpr uint64_t preemption_timer_max_value = 0xffffffff;
+
+size_t preemption_timer_rate();
+
+uint32_t tsc_to_preemption_timer(uint64_t tsc_ticks);
+uint64_t preemption_timer_to_tsc(uint32_t timer_ticks);
+
+// activate_preemption_timer + save_preemption_timer_value
+void enable_preemption_timer(pin_based_exec_controls_t& pin_based, vmexit_controls_t& vmexit);
+
+// Round-robin time slicing of vcpus sharing a physical cpu, driven by
+// the preemption timer instead of host timer interrupts.
+// a vcpu keeps the unused part of its slice across unrelated vmexits, and
+// only loses the cpu when the timer expires (or when it is made not runnable).
+// usage, for the vcpu returned by current():
+//  - load its vmcs, arm(), vmentry
+//  - on vmexit: if on_vmexit(reason) returns true, switch to current().
+// one scheduler per physical cpu, not thread safe.
+class timeslice_scheduler_t {
+public:
+    static constexpr size_t max_vcpus = 64;
+    static constexpr size_t no_vcpu = static_cast<size_t>(-1);
+
+    explicit timeslice_scheduler_t(uint64_t quantum_tsc_ticks);
+
+    bool add(size_t& id);
+    void remove(size_t id);
+
+    void runnable(size_t id, bool runnable);
+    bool is_runnable(size_t id) const;
+
+    size_t current() const;
+    uint32_t remaining(size_t id) const;
+
+    // moves to the next runnable vcpu, returns the new current
+    // vcpu, or no_vcpu if none is runnable.
+    size_t rotate();
+
+    bool has_other_runnable() const;
+    // directed yield (e.g. from ple_controller_t): gives the cpu to the next
+    // runnable vcpu, the current one keeps the rest of its slice.
+    // returns true if the current vcpu was switched.
+    bool yield();
+
+    // writes the remaining slice of the current vcpu into its vmcs.
+    // current() must be a vcpu, and its vmcs must be the current vmcs.
+    instruction_result_t arm();
+
+    // returns true if the current vcpu was switched.
+    bool on_vmexit(exit_reason_t reason);
+
+private:
+    struct vcpu_t {
+        bool used;
+        bool runnable;
+        // the vmcs field doesn't hold the remaining value (refilled/not armed yet)
+        bool dirty;
+        uint32_t remaining;
+    };
+
+    void refill(vcpu_t& vcpu);
+
+    vcpu_t m_vcpus[max_vcpus];
+    size_t m_current;
+    uint32_t m_quantum;
+};
+
+}
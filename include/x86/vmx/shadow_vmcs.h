@@ -0,0 +1,80 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/bitmap.h"
+#include "x86/paging/paging.h"
+#include "x86/vmx/vmx.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/controls.h"
+
+
+namespace x86::vmx {
+
+// VMCS Shadowing [SDM 3 24.10, 30.3]
+// when secondary_processor_based_exec_controls_t.vmcs_shadowing = 1, vmread/vmwrite
+// in vmx non-root operation access the shadow vmcs (referenced by guest_link_pointer)
+// instead of exiting, for fields which are clear in the vmread/vmwrite bitmaps.
+// this lets a nested hypervisor (L1) access its vmcs for L2 without trapping to L0.
+// L0 syncs the shadow vmcs with its copy of the L1 vmcs on nested transitions.
+
+#pragma pack(push, 1)
+
+// VMREAD and VMWRITE bitmaps [SDM 3 24.6.15]
+// a 4k bitmap indexed by bits 14:0 of the field encoding, a set bit means the access
+// causes a vmexit. accesses to encodings with bits 63:15 set always exit.
+// the bitmap must be 4k aligned.
+struct vmcs_field_bitmap_t {
+    static constexpr size_t word_count = x86::paging::page_size_4k / sizeof(uint64_t);
+    static constexpr uint32_t index_mask = 0x7fff;
+
+    uint64_t words[word_count];
+
+    void intercept_all();
+    void passthrough_all();
+
+    void intercept(field_t field);
+    void passthrough(field_t field);
+    void intercept(const field_t* fields, size_t count);
+    void passthrough(const field_t* fields, size_t count);
+
+    bool is_intercepted(field_t field) const;
+};
+static_assert(sizeof(vmcs_field_bitmap_t) == x86::paging::page_size_4k, "sizeof(vmcs_field_bitmap_t)");
+
+#pragma pack(pop)
+
+// the shadow vmcs region is a normal vmcs region with the shadow indicator set.
+// like any vmcs, it should be vmcleared once before first use.
+static inline bool initialize_shadow_vmcs(vmstruct_t& vm_struct) {
+    return initialize_vmstruct(vm_struct, true);
+}
+
+bool is_vmcs_shadowing_supported();
+
+void enable_vmcs_shadowing(processor_based_exec_controls_t& controls,
+                           secondary_processor_based_exec_controls_t& secondary);
+
+// writes the shadow vmcs link pointer and bitmaps into the current (ordinary) vmcs.
+// vmcs_shadowing should be set as well.
+instruction_result_t set_shadow_vmcs(physical_address_t shadow_vmcs,
+                                     physical_address_t vmread_bitmap,
+                                     physical_address_t vmwrite_bitmap);
+// guest_link_pointer must be all 1s when not using a shadow vmcs [SDM 3 26.3.1.5]
+instruction_result_t clear_shadow_vmcs();
+
+// syncing of the shadow vmcs with values held elsewhere (e.g. the L0 copy of the
+// L1 vmcs), values[i] is the value of fields[i].
+// the shadow vmcs is made current (with vmptrld) for the copy, and the vmcs which
+// was current before is made current again after. copying stops at the first field
+// which fails, so the shadow vmcs should only hold fields supported by the cpu.
+
+// used on nested vmexit to L0 (e.g. L1 vmlaunch/vmresume), to get what L1 wrote.
+instruction_result_t read_shadow_fields(physical_address_t shadow_vmcs,
+                                        const field_t* fields, uint64_t* values, size_t count);
+// used before resuming L1, to show it the updated values (e.g. exit information).
+// read-only fields can be written into the shadow only if
+// ia32_vmx_misc_t.vmwrite_to_all_fields is supported.
+instruction_result_t write_shadow_fields(physical_address_t shadow_vmcs,
+                                         const field_t* fields, const uint64_t* values, size_t count);
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/msr.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/controls.h"
+#include "x86/vmx/msr_area.h"
+
+
+namespace x86::vmx {
+
+// TSC Offsetting and Scaling [SDM 3 25.3, 26.6.5]
+// with use_tsc_offsetting (and use_tsc_scaling) and no rdtsc_exiting,
+// rdtsc/rdtscp/rdmsr(IA32_TIME_STAMP_COUNTER) in the guest return
+//      ((host tsc * ctrl_tsc_multiplier) >> 48) + ctrl_tsc_offset
+// without a vmexit. the multiplier is a 16.48 fixed point value.
+// rdtscp also needs secondary enable_rdtscp (otherwise #UD), and returns
+// IA32_TSC_AUX in ecx, which should be switched to the guest's value.
+
+static constexpr size_t tsc_multiplier_fraction_bits = 48;
+static constexpr uint64_t tsc_multiplier_identity = 1ull << tsc_multiplier_fraction_bits;
+
+// the secondary use_tsc_scaling control is allowed [SDM 3 A.3.3]
+bool is_tsc_scaling_supported();
+
+// Per-vcpu tsc virtualization.
+// keeps the guest tsc monotonic when the vcpu moves between cpus
+// whose tsc values aren't synchronized: call on_vcpu_put() when it stops running
+// on a cpu, and on_vcpu_load() (followed by write_to_vmcs()) on the cpu it runs next on.
+class tsc_virtualization_t {
+public:
+    tsc_virtualization_t();
+
+    uint64_t multiplier() const;
+    uint64_t offset() const;
+    bool is_scaling() const;
+
+    // guest tsc runs at guest_frequency while the host runs at host_frequency,
+    // in any unit as long as it is the same for both. the guest tsc value is kept
+    // continuous across the change.
+    // fails if the ratio doesn't fit the 16.48 multiplier.
+    bool set_frequency(uint64_t guest_frequency, uint64_t host_frequency);
+
+    // set the offset so the guest tsc is value at host tsc host_tsc.
+    void set_guest_tsc(uint64_t value, uint64_t host_tsc);
+
+    uint64_t guest_tsc(uint64_t host_tsc) const;
+
+    void on_vcpu_put(uint64_t host_tsc);
+    void on_vcpu_load(uint64_t host_tsc);
+
+    // use_tsc_offsetting and no rdtsc_exiting, use_tsc_scaling when scaling, and
+    // enable_rdtscp if asked for (rdtscp otherwise raises #UD in the guest).
+    void configure_controls(processor_based_exec_controls_t& controls,
+                            secondary_processor_based_exec_controls_t& secondary_controls,
+                            bool enable_rdtscp = false) const;
+
+    // writes offset/multiplier into the current vmcs, only if they changed since the last
+    // write. use_tsc_scaling in the vmcs is updated when scaling starts or stops (with
+    // activate_secondary_controls). fails with vm_fail_invalid, writing nothing but the
+    // offset, if scaling isn't supported.
+    instruction_result_t write_to_vmcs();
+
+private:
+    uint64_t m_multiplier;
+    uint64_t m_offset;
+    uint64_t m_last_guest_tsc;
+    bool m_dirty;
+    // use_tsc_scaling and the multiplier in the vmcs were last written for scaling
+    bool m_scaling_in_vmcs;
+};
+
+// switch IA32_TSC_AUX (returned by rdtscp) to the guest's value on entry.
+bool add_guest_tsc_aux(msr_switch_t& msr_switch, uint32_t guest_aux);
+
+}
@@ -3,6 +3,10 @@
 #include "x86/common.h"
 #include "x86/vmx/error.h"
 
+#ifdef X86_VMX_MOCK
+#include "x86/vmx/mock.h"
+#endif
+
 
 namespace x86::vmx {
 
@@ -207,43 +211,63 @@ static_assert(sizeof(vmentry_interruption_info_t) == 4, "sizeof(vmentry_interrup
 // for improvement of instructions later: https://github.com/opnsense/src/blob/cdc5c1db54c5183add40a0a48a7692d7d4ac4a31/sys/amd64/vmm/intel/vmx_cpufunc.h#L118
 
 static inline instruction_result_t vmclear(physical_address_t vmcs_address) {
+#ifdef X86_VMX_MOCK
+    return mock::vmclear(vmcs_address);
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmclear %1\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : "m"(*reinterpret_cast<uint64_t*>(&vmcs_address)) : "memory");
     return error;
+#endif
 }
 
 static inline instruction_result_t vmread(field_t field, uint64_t& value) {
+#ifdef X86_VMX_MOCK
+    return mock::vmread(static_cast<uint32_t>(field), value);
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmread %[field], %[value]\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error), [value]"=m"(value) : [field]"r"(static_cast<uint64_t>(field)) : "memory");
     return error;
+#endif
 }
 
 static inline instruction_result_t vmwrite(field_t field, uint64_t value) {
+#ifdef X86_VMX_MOCK
+    return mock::vmwrite(static_cast<uint32_t>(field), value);
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmwrite %2, %1\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : "r"(static_cast<uint64_t>(field)), "r"(value) : "memory");
     return error;
+#endif
 }
 
 static inline instruction_result_t vmptrld(physical_address_t vmcs_address) {
+#ifdef X86_VMX_MOCK
+    return mock::vmptrld(vmcs_address);
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmptrld %1\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : "m"(*reinterpret_cast<uint64_t*>(&vmcs_address)) : "memory");
     return error;
+#endif
 }
 
 static inline instruction_result_t vmptrst(physical_address_t& vmcs_address) {
+#ifdef X86_VMX_MOCK
+    return mock::vmptrst(vmcs_address);
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmptrst %1\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error), "=m"(*reinterpret_cast<uint64_t*>(&vmcs_address)) : : "memory");
     return error;
+#endif
 }
 
 static inline instruction_error_t vm_instruction_error() {
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/vmcs.h"
+
+
+namespace x86::vmx {
+
+// Binary image of the vmcs fields, for snapshots and migration.
+// the image holds the values of the fields in a fixed field list (all fields of field_t,
+// ordered by encoding, so grouped by width [SDM 3 24.11.2]). a present bitmap marks which
+// fields have a value, and the values of the present fields are packed one after the other
+// in list order, each taking its field width (16, 32, 64 or natural width bits).
+// fields the cpu doesn't support are not present.
+//
+// a full image holds all readable fields. a delta image holds only the fields which changed
+// from a base image, and is restored on top of a vmcs holding the base (or with apply_delta).
+//
+// the image doesn't depend on a specific cpu, but it is only restorable to a vmcs with the
+// same revision.
+
+static constexpr size_t vmcs_image_field_count = 154;
+// sum of the widths of all fields in the list
+static constexpr size_t vmcs_image_data_size = 912;
+
+enum class vmcs_image_kind_t : uint16_t {
+    full = 0,
+    delta = 1
+};
+
+#pragma pack(push, 1)
+
+struct vmcs_image_t {
+    static constexpr uint32_t magic_value = 0x53434d56; // "VMCS"
+    static constexpr uint16_t current_version = 1;
+    static constexpr size_t present_words = (vmcs_image_field_count + 63) / 64;
+
+    uint32_t magic;
+    uint16_t version;
+    vmcs_image_kind_t kind;
+    uint32_t revision;
+    // bytes used in data
+    uint32_t data_size;
+    uint64_t present[present_words];
+    uint8_t data[vmcs_image_data_size];
+
+    // checks the header, and that the image was made for the vmcs revision of this cpu
+    bool is_valid() const;
+    // size of the used part of the image (the header and the used data)
+    size_t size() const;
+
+    bool has(field_t field) const;
+    bool get(field_t field, uint64_t& value) const;
+};
+
+#pragma pack(pop)
+
+// saves all readable fields of the current vmcs.
+instruction_result_t save_vmcs(vmcs_image_t& image);
+// saves only the fields of the current vmcs which differ from base (or aren't in it).
+instruction_result_t save_vmcs_delta(vmcs_image_t& image, const vmcs_image_t& base);
+
+// writes the present fields of the image into the current vmcs. read-only fields are
+// skipped. if current is given, it should hold the values the vmcs currently has
+// (e.g. the image it was last saved/restored to), and fields with the same value in
+// it are skipped as well.
+// returns vm_fail_invalid for an invalid image.
+instruction_result_t restore_vmcs(const vmcs_image_t& image, const vmcs_image_t* current=nullptr);
+
+// merges a delta image into a full image in memory, e.g. to collapse incremental checkpoints.
+bool apply_delta(vmcs_image_t& base, const vmcs_image_t& delta);
+
+}
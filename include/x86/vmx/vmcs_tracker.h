@@ -0,0 +1,61 @@
+#pragma once
+
+#include "x86/common.h"
+#include "x86/vmx/error.h"
+#include "x86/vmx/vmexit.h"
+
+
+namespace x86::vmx {
+
+// Per-cpu tracking of VMCS ownership and launch state [SDM 3 24.1, 24.11.3]
+// a vmcs stays active on the cpu which last loaded it until it is vmcleared. so
+// switching between vcpus on the same cpu only needs a vmptrld when the vmcs isn't
+// already current, and a vmclear is only needed when the vcpu moves to another
+// cpu (the vmcs data may be cached on the old one). the launch state is cleared
+// by vmclear, and decides whether the vmcs is entered with vmlaunch or vmresume.
+
+static constexpr uint32_t no_cpu = static_cast<uint32_t>(-1);
+
+struct vmcs_state_t {
+    physical_address_t address;
+    // cpu on which the vmcs is active, or no_cpu if it is clear. claimed atomically,
+    // so two cpus can't both load it.
+    volatile uint32_t owner;
+    bool launched;
+
+    explicit vmcs_state_t(physical_address_t address);
+};
+
+// one instance per cpu, only used from that cpu.
+class vmcs_tracker_t {
+public:
+    explicit vmcs_tracker_t(uint32_t cpu);
+
+    uint32_t cpu() const;
+    vmcs_state_t* current() const;
+
+    // makes the vmcs current on this cpu, doing vmptrld only if it isn't already.
+    // a vmcs active on another cpu must first be released there, otherwise
+    // vm_fail_invalid is returned without touching it.
+    instruction_result_t load(vmcs_state_t& vmcs);
+
+    // vmclear the vmcs if it is active on this cpu. call on the owner cpu
+    // before the vcpu migrates to another cpu, or before freeing the vmcs.
+    instruction_result_t release(vmcs_state_t& vmcs);
+    // releases the current vmcs (e.g. before vmxoff).
+    instruction_result_t release_current();
+
+    // enters the current vmcs with vmlaunch or vmresume according to its launch
+    // state. only returns if the entry failed.
+    instruction_result_t enter();
+    // the launch state becomes "launched" once a vmlaunch succeeds, so this
+    // must be called from the vmexit handler, with the exit_reason field. an exit
+    // for a failed vmentry leaves the launch state as it was [SDM 3 26.8].
+    void on_vmexit(const full_exit_reason_t& reason);
+
+private:
+    uint32_t m_cpu;
+    vmcs_state_t* m_current;
+};
+
+}
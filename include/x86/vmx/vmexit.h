@@ -69,4 +69,26 @@ enum class exit_reason_t : uint16_t {
     xrstors = 64,
 };
 
+#pragma pack(push, 1)
+
+// the exit_reason field [SDM 3 24.9.1 "Table 24-14"]
+struct full_exit_reason_t {
+    union {
+        struct {
+            uint32_t basic_reason : 16;
+            uint32_t unused0 : 11;
+            uint32_t enclave_mode : 1;
+            uint32_t pending_mtf : 1;
+            uint32_t exit_from_vmx_root : 1;
+            uint32_t unused1 : 1;
+            // the vmentry failed while loading the guest state or msrs [SDM 3 26.8]
+            uint32_t vmentry_failure : 1;
+        } bits;
+        uint32_t raw;
+    };
+};
+static_assert(sizeof(full_exit_reason_t) == 4, "sizeof(full_exit_reason_t)");
+
+#pragma pack(pop)
+
 }
@@ -5,6 +5,10 @@
 #include "x86/cr.h"
 #include "x86/vmx/error.h"
 
+#ifdef X86_VMX_MOCK
+#include "x86/vmx/mock.h"
+#endif
+
 namespace x86::vmx {
 
 #pragma pack(push, 1)
@@ -54,28 +58,53 @@ static inline bool is_cr4_valid(const uintn_t cr) {
 }
 
 bool prepare_for_vmxon(bool for_unrestricted_guest=false);
-bool initialize_vmstruct(vmstruct_t& vm_struct);
+// shadow should only be set for shadow vmcs regions (requires vmcs_shadowing support) [SDM 3 24.10]
+bool initialize_vmstruct(vmstruct_t& vm_struct, bool shadow=false);
 
 static inline instruction_result_t vmxon(physical_address_t vmxon_region_address) {
+#ifdef X86_VMX_MOCK
+    return mock::vmxon(vmxon_region_address);
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmxon %1\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : "m" (*reinterpret_cast<uint64_t*>(&vmxon_region_address)) : "memory");
     return error;
+#endif
 }
 
 static inline instruction_result_t vmxoff() {
+#ifdef X86_VMX_MOCK
+    return mock::vmxoff();
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmxoff");
     return error;
+#endif
 }
 
 static inline instruction_result_t vmlaunch() {
+#ifdef X86_VMX_MOCK
+    return mock::vmlaunch();
+#else
     auto error = instruction_result_t::success;
     asm volatile("vmlaunch\n"
                  VMX_SET_ERROR_CODE
             : [error] "=r"(error) : : "memory");
     return error;
+#endif
+}
+
+static inline instruction_result_t vmresume() {
+#ifdef X86_VMX_MOCK
+    return mock::vmresume();
+#else
+    auto error = instruction_result_t::success;
+    asm volatile("vmresume\n"
+                 VMX_SET_ERROR_CODE
+            : [error] "=r"(error) : : "memory");
+    return error;
+#endif
 }
 
 }
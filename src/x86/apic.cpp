@@ -1,17 +1,86 @@
 
 #include "x86/msr.h"
-#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
+#include "x86/paging/paging.h"
+#include "x86/interrupts.h"
 #include "x86/apic.h"
 
 
 namespace x86::apic {
 
+// [SDM 3 10.6.1 "Figure 10-12"]
+static constexpr uint32_t icr_delivery_status = bit(12);
+static constexpr uint32_t xapic_destination_shift = 24;
+// [SDM 3 10.4.6 "Figure 10-6"]
+static constexpr uint32_t xapic_id_shift = 24;
+
+// the mode and xAPIC base belong to each cpu, the runtime selected functions read them
+// from ia32_apic_base every time. only xapic_access_t uses the cached base, as code
+// using it already knows the mode of the cpu.
+struct state_t {
+    bool loaded;
+    physical_address_t xapic_base;
+};
+
+static state_t g_state{};
+
+static physical_address_t xapic_base(const msr::ia32_apic_base_t& apic_base) {
+    return static_cast<physical_address_t>(apic_base.bits.base) << x86::paging::page_bits_4k;
+}
+
+static bool is_x2apic(const msr::ia32_apic_base_t& apic_base) {
+    return apic_base.bits.global_enable && apic_base.bits.extd;
+}
+
+static volatile uint32_t* xapic_register(physical_address_t base, register_t reg) {
+    return reinterpret_cast<volatile uint32_t*>(base + static_cast<uint16_t>(reg));
+}
+
+static void xapic_write_icr(physical_address_t base, const icr_t& icr) {
+    auto icr_low = xapic_register(base, register_t::icr_low);
+    auto icr_high = xapic_register(base, register_t::icr_high);
+
+    // an interrupt handler sending an ipi between the two writes would replace the
+    // destination of this one
+    const auto flags = interrupts::save_and_disable();
+
+    // a previous ipi may still be pending
+    while (*icr_low & icr_delivery_status) {
+        atomic::pause();
+    }
+
+    *icr_high = icr.bits.destination << xapic_destination_shift;
+    // writing the low part sends the ipi
+    *icr_low = static_cast<uint32_t>(icr.raw);
+
+    interrupts::restore(flags);
+}
+
+static physical_address_t cached_xapic_base() {
+    if (!g_state.loaded) {
+        initialize();
+    }
+
+    return g_state.xapic_base;
+}
+
+uint32_t xapic_access_t::read(register_t reg) {
+    return *xapic_register(cached_xapic_base(), reg);
+}
+
+void xapic_access_t::write(register_t reg, uint32_t value) {
+    *xapic_register(cached_xapic_base(), reg) = value;
+}
+
+void xapic_access_t::write_icr(const icr_t& icr) {
+    xapic_write_icr(cached_xapic_base(), icr);
+}
+
 mode_t current_mode() {
     // [SDM 3 10.12.1 P398]
     auto apic_base = read<msr::ia32_apic_base_t>();
     if (apic_base.bits.global_enable) {
-        auto cpu_features = x86::cpuid<x86::cpuid_eax01_t>();
-        if (apic_base.bits.extd && cpu_features.ecx.bits.x2apic) {
+        if (apic_base.bits.extd && x86::has_feature<x86::features::x2apic>()) {
             return mode_t::x2apic;
         }
 
@@ -26,4 +95,142 @@ bool is_bsp() {
     return apic_base.bits.bsp;
 }
 
+void initialize() {
+    g_state.xapic_base = xapic_base(read<msr::ia32_apic_base_t>());
+    g_state.loaded = true;
+}
+
+void enable(uint8_t spurious_vector) {
+    write_register(register_t::svr, svr_apic_enable | spurious_vector);
+}
+
+bool enable_x2apic() {
+    if (!x86::has_feature<x86::features::x2apic>()) {
+        return false;
+    }
+
+    // [SDM 3 10.12.5 "Figure 10-27"] xAPIC -> x2APIC is done by setting extd. going
+    // from disabled straight to x2APIC raises #GP, so a disabled apic is enabled in
+    // xAPIC mode first.
+    auto apic_base = read<msr::ia32_apic_base_t>();
+    if (is_x2apic(apic_base)) {
+        return true;
+    }
+
+    if (!apic_base.bits.global_enable) {
+        apic_base.bits.global_enable = true;
+        apic_base.bits.extd = false;
+        write(apic_base);
+    }
+
+    apic_base.bits.extd = true;
+    write(apic_base);
+    return true;
+}
+
+uint32_t id() {
+    const auto apic_base = read<msr::ia32_apic_base_t>();
+    if (is_x2apic(apic_base)) {
+        return x2apic_access_t::read(register_t::id);
+    }
+
+    return *xapic_register(xapic_base(apic_base), register_t::id) >> xapic_id_shift;
+}
+
+uint32_t read_register(register_t reg) {
+    const auto apic_base = read<msr::ia32_apic_base_t>();
+    if (is_x2apic(apic_base)) {
+        return x2apic_access_t::read(reg);
+    }
+
+    return *xapic_register(xapic_base(apic_base), reg);
+}
+
+void write_register(register_t reg, uint32_t value) {
+    const auto apic_base = read<msr::ia32_apic_base_t>();
+    if (is_x2apic(apic_base)) {
+        x2apic_access_t::write(reg, value);
+    } else {
+        *xapic_register(xapic_base(apic_base), reg) = value;
+    }
+}
+
+void eoi() {
+    // [SDM 3 10.8.5] any value, must be 0 in x2APIC mode
+    write_register(register_t::eoi, 0);
+}
+
+icr_t make_icr(uint8_t vector,
+               delivery_mode_t delivery_mode,
+               uint32_t destination,
+               destination_mode_t destination_mode,
+               shorthand_t shorthand) {
+    icr_t icr{};
+    icr.bits.vector = vector;
+    icr.bits.delivery_mode = static_cast<uint64_t>(delivery_mode);
+    icr.bits.destination_mode = static_cast<uint64_t>(destination_mode);
+    // edge triggered, level must be assert for all but init level de-assert
+    icr.bits.level = 1;
+    icr.bits.shorthand = static_cast<uint64_t>(shorthand);
+    icr.bits.destination = destination;
+    return icr;
+}
+
+void send_ipi(const icr_t& icr) {
+    const auto apic_base = read<msr::ia32_apic_base_t>();
+    if (is_x2apic(apic_base)) {
+        send_ipi<x2apic_access_t>(icr);
+    } else {
+        xapic_write_icr(xapic_base(apic_base), icr);
+    }
+}
+
+void send_fixed_ipi(uint32_t destination, uint8_t vector) {
+    send_ipi(make_icr(vector, delivery_mode_t::fixed, destination));
+}
+
+void send_nmi(uint32_t destination) {
+    send_ipi(make_icr(0, delivery_mode_t::nmi, destination));
+}
+
+void send_init(uint32_t destination) {
+    send_ipi(make_icr(0, delivery_mode_t::init, destination));
+}
+
+void send_startup(uint32_t destination, uint8_t page_number) {
+    send_ipi(make_icr(page_number, delivery_mode_t::startup, destination));
+}
+
+void broadcast_fixed_ipi(uint8_t vector) {
+    send_ipi(make_icr(vector, delivery_mode_t::fixed, 0, destination_mode_t::physical, shorthand_t::all_excluding_self));
+}
+
+uint8_t task_priority() {
+    return static_cast<uint8_t>(read_register(register_t::tpr));
+}
+
+void set_task_priority(uint8_t priority) {
+    write_register(register_t::tpr, priority);
+}
+
+bool enable_deadline_timer(uint8_t vector) {
+    if (!x86::has_feature<x86::features::tsc_deadline>()) {
+        return false;
+    }
+
+    write_register(register_t::lvt_timer, lvt_timer_tsc_deadline | vector);
+    // [SDM 3 10.5.4.1] the deadline write must not pass the switch to deadline mode
+    atomic::mb();
+    return true;
+}
+
+void set_deadline(uint64_t tsc) {
+    // 0 would disarm the timer
+    x86::write(msr::ia32_tsc_deadline_t(tsc == 0 ? 1 : tsc));
+}
+
+void cancel_deadline() {
+    x86::write(msr::ia32_tsc_deadline_t(0));
+}
+
 }
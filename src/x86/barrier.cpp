@@ -0,0 +1,29 @@
+
+#include "x86/atomic.h"
+#include "x86/barrier.h"
+
+
+namespace x86 {
+
+uint32_t barrier_t::count() const {
+    return m_count;
+}
+
+void barrier_t::wait() {
+    // the sense must be read before arriving, the last cpu flips it right after
+    const auto sense = m_sense;
+
+    if (atomic::fetchadd32(&m_remaining, static_cast<uint32_t>(-1)) == 1) {
+        // the others only touch m_remaining again after the flip
+        m_remaining = m_count;
+        atomic::wmb();
+        m_sense = sense ^ 1;
+        return;
+    }
+
+    while (m_sense == sense) {
+        atomic::pause();
+    }
+}
+
+}
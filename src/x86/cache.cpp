@@ -0,0 +1,53 @@
+
+#include "x86/cache.h"
+#include "x86/cpu_features.h"
+#include "x86/tlb.h"
+
+
+namespace x86::cache {
+
+static void flush_caches() {
+    // with self-snooping, the cpu keeps its caches coherent with the memory type change
+    if (!cpu_features().has<features::self_snoop>()) {
+        wbinvd();
+    }
+}
+
+// clearing CR4.PGE flushes all the tlb entries, including global ones (and all pcids),
+// otherwise reloading CR3 flushes the non-global ones which are all there are.
+// PGE stays clear until exit_no_fill_mode [SDM 3 11.11.8 steps 6 and 13].
+static void flush_tlbs(const cr4_t& cr4) {
+    if (cr4.bits.page_global_enable) {
+        auto without_global = cr4;
+        without_global.bits.page_global_enable = false;
+        x86::write(without_global);
+    } else {
+        tlb::flush();
+    }
+}
+
+no_fill_state_t enter_no_fill_mode() {
+    no_fill_state_t state{x86::read<cr0_t>(), x86::read<cr4_t>()};
+
+    auto cr0 = state.cr0;
+    cr0.bits.cache_disable = true;
+    cr0.bits.not_write_through = false;
+    x86::write(cr0);
+
+    flush_caches();
+    flush_tlbs(state.cr4);
+
+    return state;
+}
+
+void exit_no_fill_mode(const no_fill_state_t& state) {
+    flush_caches();
+    // CR4.PGE is clear at this point, so there are no global entries to flush
+    tlb::flush();
+
+    x86::write(state.cr0);
+    // restores CR4.PGE if it was cleared by enter_no_fill_mode
+    x86::write(state.cr4);
+}
+
+}
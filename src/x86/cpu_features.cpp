@@ -0,0 +1,101 @@
+
+#include "x86/atomic.h"
+#include "x86/cpu_features.h"
+
+
+namespace x86 {
+
+namespace detail {
+
+cpu_features_t g_cpu_features{};
+
+}
+
+enum load_state_t : uint32_t {
+    not_loaded,
+    loading,
+    done
+};
+
+static volatile uint32_t g_load_state = not_loaded;
+
+static void capture(cpu_features_t& features, cpuid_t leaf, cpuid_t subleaf = 0) {
+    const auto regs = cpuid(leaf, subleaf);
+    auto& captured = features.regs[cpu_features_t::index_of(leaf, subleaf)];
+    captured[static_cast<size_t>(cpuid_register_t::eax)] = regs.eax;
+    captured[static_cast<size_t>(cpuid_register_t::ebx)] = regs.ebx;
+    captured[static_cast<size_t>(cpuid_register_t::ecx)] = regs.ecx;
+    captured[static_cast<size_t>(cpuid_register_t::edx)] = regs.edx;
+}
+
+void cpu_features_t::load() {
+    for (auto& leaf_regs : regs) {
+        for (auto& reg : leaf_regs) {
+            reg = 0;
+        }
+    }
+
+    // [SDM 2 "CPUID"] leaves above the max return the data of the highest basic
+    // leaf, so they are not read.
+    max_basic_leaf = cpuid(basic_first, 0).eax;
+    for (cpuid_t leaf = basic_first; leaf <= max_basic_leaf && leaf < basic_first + basic_leaves; ++leaf) {
+        capture(*this, leaf);
+    }
+    for (const auto& subleaf : captured_subleaves) {
+        // leaf 7 reports its max subleaf [SDM 2 "CPUID" Table 3-8]
+        const auto supported = subleaf[0] == 0x7 ?
+                regs[index_of(0x7)][static_cast<size_t>(cpuid_register_t::eax)] >= subleaf[1] :
+                true;
+        if (subleaf[0] <= max_basic_leaf && supported) {
+            capture(*this, subleaf[0], subleaf[1]);
+        }
+    }
+
+    max_extended_leaf = cpuid(extended_first, 0).eax;
+    if (max_extended_leaf < extended_first) {
+        max_extended_leaf = 0;
+    }
+    for (cpuid_t leaf = extended_first; leaf <= max_extended_leaf && leaf < extended_first + extended_leaves; ++leaf) {
+        capture(*this, leaf);
+    }
+
+    // the registers are visible before the flag to the cpus testing it without a lock
+    atomic::wmb();
+    loaded = true;
+}
+
+bool cpu_features_t::is_leaf_supported(cpuid_t leaf) const {
+    if (leaf >= extended_first) {
+        return leaf <= max_extended_leaf;
+    }
+
+    return leaf <= max_basic_leaf;
+}
+
+cpuid_regs_t cpu_features_t::leaf(cpuid_t leaf, cpuid_t subleaf) const {
+    if (!is_captured(leaf, subleaf)) {
+        return {};
+    }
+
+    const auto& captured = regs[index_of(leaf, subleaf)];
+    return {
+        captured[static_cast<size_t>(cpuid_register_t::eax)],
+        captured[static_cast<size_t>(cpuid_register_t::ebx)],
+        captured[static_cast<size_t>(cpuid_register_t::ecx)],
+        captured[static_cast<size_t>(cpuid_register_t::edx)]
+    };
+}
+
+void load_cpu_features() {
+    if (atomic::cmpswap32(&g_load_state, not_loaded, loading)) {
+        detail::g_cpu_features.load();
+        g_load_state = done;
+        return;
+    }
+
+    while (g_load_state != done) {
+        atomic::pause();
+    }
+}
+
+}
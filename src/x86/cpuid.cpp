@@ -1,16 +1,16 @@
 
 #include "x86/cpuid.h"
+#include "x86/cpu_features.h"
 
 
 namespace x86 {
 
 cpuid_t max_supported_cpuid_leaf() {
-    auto cpuid = x86::cpuid<0x80000000>();
-    return cpuid.eax;
+    return cpu_features().max_extended_leaf;
 }
 
 bool is_cpuid_leaf_supported(cpuid_t leaf) {
-    return leaf >= max_supported_cpuid_leaf();
+    return cpu_features().is_leaf_supported(leaf);
 }
 
 }
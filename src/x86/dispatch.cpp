@@ -0,0 +1,69 @@
+
+#include "x86/dispatch.h"
+
+
+namespace x86::dispatch {
+
+// [SDM 1 13.3] xcr0 components
+static constexpr uint64_t xcr0_sse = bit(1);
+static constexpr uint64_t xcr0_avx = bit(2);
+static constexpr uint64_t xcr0_opmask = bit(5);
+static constexpr uint64_t xcr0_zmm_hi256 = bit(6);
+static constexpr uint64_t xcr0_hi16_zmm = bit(7);
+
+static bool is_v2(const cpu_features_t& cpu) {
+    return cpu.has<features::cmpxchg16b>() &&
+           cpu.has<features::lahf_lm>() &&
+           cpu.has<features::popcnt>() &&
+           cpu.has<features::sse3>() &&
+           cpu.has<features::sse41>() &&
+           cpu.has<features::sse42>() &&
+           cpu.has<features::ssse3>();
+}
+
+static bool is_v3(const cpu_features_t& cpu, uint64_t xcr0) {
+    constexpr auto state = xcr0_sse | xcr0_avx;
+    return cpu.has<features::avx>() &&
+           cpu.has<features::avx2>() &&
+           cpu.has<features::bmi1>() &&
+           cpu.has<features::bmi2>() &&
+           cpu.has<features::f16c>() &&
+           cpu.has<features::fma>() &&
+           cpu.has<features::lzcnt>() &&
+           cpu.has<features::movbe>() &&
+           (xcr0 & state) == state;
+}
+
+static bool is_v4(const cpu_features_t& cpu, uint64_t xcr0) {
+    constexpr auto state = xcr0_opmask | xcr0_zmm_hi256 | xcr0_hi16_zmm;
+    return cpu.has<features::avx512f>() &&
+           cpu.has<features::avx512bw>() &&
+           cpu.has<features::avx512cd>() &&
+           cpu.has<features::avx512dq>() &&
+           cpu.has<features::avx512vl>() &&
+           (xcr0 & state) == state;
+}
+
+level_t current_level() {
+    const auto& cpu = cpu_features();
+    if (!is_v2(cpu)) {
+        return level_t::baseline;
+    }
+
+    // xgetbv is only available once the os set CR4.OSXSAVE, which cpuid reflects
+    if (!cpu.has<features::xsave>() || !cpu.has<features::osxsave>()) {
+        return level_t::v2;
+    }
+
+    const auto xcr0 = xgetbv(0);
+    if (!is_v3(cpu, xcr0)) {
+        return level_t::v2;
+    }
+    if (!is_v4(cpu, xcr0)) {
+        return level_t::v3;
+    }
+
+    return level_t::v4;
+}
+
+}
@@ -0,0 +1,66 @@
+
+#include "x86/dispatch.h"
+#include "x86/memory.h"
+
+
+namespace x86::memory {
+
+static dispatch::dispatcher_t<copy_fn_t> g_copy(copy_qwords);
+static dispatch::dispatcher_t<fill_fn_t> g_fill(fill_qwords);
+
+void copy_qwords(void* dest, const void* src, size_t size) {
+    asm volatile("rep movsq\n"
+                 "mov %3, %%rcx\n"
+                 "rep movsb"
+            : "+D"(dest), "+S"(src), "=&c"(size)
+            : "r"(size & 0x7), "2"(size >> 3)
+            : "memory");
+}
+
+void copy_erms(void* dest, const void* src, size_t size) {
+    asm volatile("rep movsb"
+            : "+D"(dest), "+S"(src), "+c"(size)
+            :
+            : "memory");
+}
+
+void fill_qwords(void* dest, uint8_t value, size_t size) {
+    uint64_t pattern = value * 0x0101010101010101ull;
+    asm volatile("rep stosq\n"
+                 "mov %3, %%rcx\n"
+                 "rep stosb"
+            : "+D"(dest), "=&c"(size), "+a"(pattern)
+            : "r"(size & 0x7), "1"(size >> 3)
+            : "memory");
+}
+
+void fill_erms(void* dest, uint8_t value, size_t size) {
+    asm volatile("rep stosb"
+            : "+D"(dest), "+c"(size)
+            : "a"(value)
+            : "memory");
+}
+
+void initialize() {
+    static const dispatch::variant_t<copy_fn_t> copy_variants[] = {
+        {copy_qwords, dispatch::always},
+        {copy_erms, dispatch::supports<features::erms>},
+    };
+    static const dispatch::variant_t<fill_fn_t> fill_variants[] = {
+        {fill_qwords, dispatch::always},
+        {fill_erms, dispatch::supports<features::erms>},
+    };
+
+    g_copy.resolve(copy_variants);
+    g_fill.resolve(fill_variants);
+}
+
+void copy(void* dest, const void* src, size_t size) {
+    g_copy(dest, src, size);
+}
+
+void fill(void* dest, uint8_t value, size_t size) {
+    g_fill(dest, value, size);
+}
+
+}
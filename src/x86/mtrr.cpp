@@ -1,5 +1,6 @@
 
 #include "x86/msr.h"
+#include "x86/cache.h"
 #include "x86/paging/paging.h"
 #include "x86/mtrr.h"
 
@@ -50,6 +51,114 @@ static void load_variable_mtrrs(x86::msr::ia32_mtrr_cap_t& mtrr_cap, mtrr_cache_
     }
 }
 
+// [SDM 3 11.11.2.3]
+static constexpr uint64_t variable_mask_valid = bit(11);
+
+// largest naturally aligned power of 2 block starting at address and ending by end
+static uint64_t largest_block(physical_address_t address, physical_address_t end) {
+    uint64_t size = address == 0 ? bit(63) : (address & (~address + 1));
+    while (size > end - address) {
+        size >>= 1;
+    }
+
+    return size;
+}
+
+static size_t count_blocks(physical_address_t start, physical_address_t end) {
+    size_t count = 0;
+    while (start < end) {
+        start += largest_block(start, end);
+        count++;
+    }
+
+    return count;
+}
+
+static bool add_variable_mtrr(layout_t& layout, physical_address_t base, uint64_t size, memory_type_t type) {
+    if (layout.used_count >= layout.variable_count) {
+        return false;
+    }
+
+    const auto max_address = bit(x86::paging::max_physical_address_width());
+
+    auto& mtrr_base = layout.variable_bases[layout.used_count];
+    auto& mtrr_mask = layout.variable_masks[layout.used_count];
+    mtrr_base.raw = base | static_cast<uint64_t>(type);
+    mtrr_mask.raw = (~(size - 1) & (max_address - 1)) | variable_mask_valid;
+
+    layout.used_count++;
+    return true;
+}
+
+static bool add_variable_mtrrs(layout_t& layout, physical_address_t start, physical_address_t end, memory_type_t type) {
+    while (start < end) {
+        const auto size = largest_block(start, end);
+        if (!add_variable_mtrr(layout, start, size, type)) {
+            return false;
+        }
+
+        start += size;
+    }
+
+    return true;
+}
+
+static bool overlaps(physical_address_t start, physical_address_t end, const range_t& range) {
+    return start < range.base + range.size && range.base < end;
+}
+
+// the excess of a covering block becomes UC, so it must not take from other ranges
+static bool can_cut_out(const range_t* ranges, size_t count, physical_address_t start, physical_address_t end) {
+    for (size_t i = 0; i < count; ++i) {
+        if (ranges[i].type != memory_type_t::uncacheable && overlaps(start, end, ranges[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// index of the range of the type which starts at address, count if there is none
+static size_t find_range_at(const range_t* ranges, size_t count, physical_address_t address, memory_type_t type) {
+    for (size_t i = 0; i < count; ++i) {
+        if (ranges[i].base == address && ranges[i].type == type) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+// another range of the same type ends where the range starts
+static bool continues_range(const range_t* ranges, size_t count, const range_t& range) {
+    for (size_t i = 0; i < count; ++i) {
+        if (ranges[i].type == range.type && ranges[i].base + ranges[i].size == range.base) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool is_valid_range(const range_t* ranges, size_t count, size_t index, physical_address_t max_address) {
+    const auto& range = ranges[index];
+    if (range.size == 0 ||
+        !x86::paging::is_page_aligned(range.base) ||
+        !x86::paging::is_page_aligned(range.size) ||
+        range.base + range.size > max_address ||
+        range.base + range.size < range.base) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (i != index && overlaps(range.base, range.base + range.size, ranges[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 memory_type_t mtrr_cache_t::type_for_range(physical_address_t start, size_t size) const {
     // [SDM 3 11.11.4.1]
     // [SDM 3 11.11.7.1 "Example 11-4"]
@@ -223,5 +332,135 @@ mtrr_cache_t initialize_cache() {
     return cache;
 }
 
+layout_t read_layout() {
+    layout_t layout{};
+
+    auto mtrr_cap = x86::read<x86::msr::ia32_mtrr_cap_t>();
+    auto mtrr_def = x86::read<x86::msr::ia32_mtrr_def_type_t>();
+
+    layout.enabled = mtrr_def.bits.enable;
+    layout.default_type = static_cast<memory_type_t>(mtrr_def.bits.default_type);
+    layout.fixed_enabled = mtrr_cap.bits.fixed_range_supported && mtrr_def.bits.fixed_enable;
+
+    if (mtrr_cap.bits.fixed_range_supported) {
+        for (size_t i = 0; i < fixed_msr_count; ++i) {
+            layout.fixed[i] = x86::msr::read(fixed_msr_ids[i]);
+        }
+    }
+
+    layout.variable_count = mtrr_cap.bits.variable_range_count;
+    if (layout.variable_count > mtrr_cache_t::max_variable_mtrr) {
+        layout.variable_count = mtrr_cache_t::max_variable_mtrr;
+    }
+    for (size_t i = 0; i < layout.variable_count; ++i) {
+        layout.variable_bases[i] = read_variable_base(i);
+        layout.variable_masks[i] = read_variable_mask(i);
+    }
+    layout.used_count = layout.variable_count;
+
+    return layout;
+}
+
+void write_layout(const layout_t& layout) {
+    auto mtrr_cap = x86::read<x86::msr::ia32_mtrr_cap_t>();
+
+    if (mtrr_cap.bits.fixed_range_supported) {
+        for (size_t i = 0; i < fixed_msr_count; ++i) {
+            x86::msr::write(fixed_msr_ids[i], layout.fixed[i]);
+        }
+    }
+
+    for (size_t i = 0; i < layout.variable_count; ++i) {
+        if (i < layout.used_count) {
+            write_variable_base(i, layout.variable_bases[i]);
+            write_variable_mask(i, layout.variable_masks[i]);
+        } else {
+            write_variable_mask(i, variable_mask_t{.raw = 0});
+            write_variable_base(i, variable_base_t{.raw = 0});
+        }
+    }
+
+    auto mtrr_def = x86::read<x86::msr::ia32_mtrr_def_type_t>();
+    mtrr_def.bits.default_type = static_cast<uint64_t>(layout.default_type);
+    mtrr_def.bits.fixed_enable = layout.fixed_enabled;
+    mtrr_def.bits.enable = layout.enabled;
+    x86::write(mtrr_def);
+}
+
+bool compute_variable_mtrrs(layout_t& layout, memory_type_t default_type, const range_t* ranges, size_t count) {
+    const auto max_address = bit(x86::paging::max_physical_address_width());
+    for (size_t i = 0; i < count; ++i) {
+        if (!is_valid_range(ranges, count, i, max_address)) {
+            return false;
+        }
+    }
+
+    layout.default_type = default_type;
+    layout.used_count = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto& range = ranges[i];
+        if (range.type == default_type) {
+            continue;
+        }
+
+        // adjacent ranges of the same type are covered as one, from the first of them
+        if (continues_range(ranges, count, range)) {
+            continue;
+        }
+
+        const auto start = range.base;
+        auto end = range.base + range.size;
+        for (auto next = find_range_at(ranges, count, end, range.type); next != count;
+             next = find_range_at(ranges, count, end, range.type)) {
+            end += ranges[next].size;
+        }
+
+        if (default_type == memory_type_t::uncacheable) {
+            // smallest aligned block containing the range
+            const auto block_size = bit(bit_scan_reverse(start ^ (end - 1)) + 1);
+            const auto block_start = start & ~(block_size - 1);
+            const auto block_end = block_start + block_size;
+
+            if (block_end <= max_address &&
+                can_cut_out(ranges, count, block_start, start) &&
+                can_cut_out(ranges, count, end, block_end) &&
+                1 + count_blocks(block_start, start) + count_blocks(end, block_end) < count_blocks(start, end)) {
+                if (!add_variable_mtrr(layout, block_start, block_size, range.type) ||
+                    !add_variable_mtrrs(layout, block_start, start, memory_type_t::uncacheable) ||
+                    !add_variable_mtrrs(layout, end, block_end, memory_type_t::uncacheable)) {
+                    return false;
+                }
+                continue;
+            }
+        }
+
+        if (!add_variable_mtrrs(layout, start, end, range.type)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void update(barrier_t& barrier, const layout_t& layout) {
+    // [SDM 3 11.11.8] step 3, all the cpus start together
+    barrier.wait();
+
+    const auto state = cache::enter_no_fill_mode();
+
+    // step 8, the mtrrs are disabled while they are changed
+    auto mtrr_def = x86::read<x86::msr::ia32_mtrr_def_type_t>();
+    mtrr_def.bits.enable = false;
+    x86::write(mtrr_def);
+
+    write_layout(layout);
+
+    cache::exit_no_fill_mode(state);
+
+    // step 14, none continue until all have the new mtrrs
+    barrier.wait();
+}
+
 }
 }
@@ -1,5 +1,5 @@
 #include "x86/cr.h"
-#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
 #include "x86/paging/bit32.h"
 
 
@@ -57,8 +57,7 @@ void pte_t::address(physical_address_t address) {
 
 bool are_4m_page_tables_supported() {
     // [SDM 3 4.1.4 P109]
-    auto cpuid = x86::cpuid<cpuid_eax01_t>();
-    return cpuid.edx.bits.pse != 0;
+    return x86::has_feature<x86::features::pse>();
 }
 
 bool are_4m_page_tables_enabled() {
@@ -73,8 +72,7 @@ bool are_4m_page_tables_enabled() {
 
 bool is_pse36_supported() {
     // [SDM 3 4.1.4 P109]
-    auto cpuid = x86::cpuid<cpuid_eax01_t>();
-    return cpuid.edx.bits.pse36 != 0;
+    return x86::has_feature<x86::features::pse36>();
 }
 
 bool to_physical(x86::cr3_t& cr3, linear_address_t address, physical_address_t& out) {
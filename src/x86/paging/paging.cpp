@@ -1,7 +1,7 @@
 
 #include "x86/cr.h"
 #include "x86/msr.h"
-#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
 #include "x86/paging/paging.h"
 
 
@@ -35,13 +35,12 @@ size_t max_physical_address_width() {
 
     // is leaf supported?
     // if not return 36 if cpuid_eax01_t.edx.pae = 1, or 32 otherwise
-    if (x86::is_cpuid_leaf_supported(0x80000008)) {
-        auto cpuid_maxphysaddr = x86::cpuid<0x80000008>();
-        return cpuid_maxphysaddr.eax & 0xff;
+    const auto& features = x86::cpu_features();
+    if (features.is_leaf_supported(0x80000008)) {
+        return features.leaf(0x80000008).eax & 0xff;
     }
 
-    auto cpuid_features = x86::cpuid<x86::cpuid_eax01_t>();
-    return cpuid_features.edx.bits.pae ? 36 : 32;
+    return features.has<x86::features::pae>() ? 36 : 32;
 }
 
 }
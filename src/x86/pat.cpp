@@ -0,0 +1,228 @@
+
+#include "x86/cache.h"
+#include "x86/cpu_features.h"
+#include "x86/pat.h"
+
+
+namespace x86::pat {
+
+using mtrr::memory_type_t;
+
+// entries reachable without the pat bit
+static constexpr size_t non_leaf_entries = 4;
+static constexpr size_t bits_per_entry = 8;
+static constexpr msr::value_t entry_type_mask = 0x7;
+// bits 7:3 of every entry are reserved
+static constexpr msr::value_t reserved_mask = 0xf8f8f8f8f8f8f8f8ull;
+
+static bool is_valid_type(memory_type_t type) {
+    switch (type) {
+        case memory_type_t::uncacheable:
+        case memory_type_t::write_coombining:
+        case memory_type_t::write_through:
+        case memory_type_t::write_protected:
+        case memory_type_t::writeback:
+            return true;
+        default:
+            return type == uncached_minus;
+    }
+}
+
+template<typename _bits>
+static void set_leaf_bits(_bits& bits, const entry_bits_t& entry) {
+    bits.pat = entry.pat;
+    bits.pcd = entry.pcd;
+    bits.pwt = entry.pwt;
+}
+
+template<typename _bits>
+static void set_non_leaf_bits(_bits& bits, const entry_bits_t& entry) {
+    bits.pcd = entry.pcd;
+    bits.pwt = entry.pwt;
+}
+
+template<typename _bits>
+static size_t leaf_index(const _bits& bits) {
+    return entry_bits_t{bits.pat != 0, bits.pcd != 0, bits.pwt != 0}.index();
+}
+
+template<typename _bits>
+static size_t non_leaf_index(const _bits& bits) {
+    return entry_bits_t{false, bits.pcd != 0, bits.pwt != 0}.index();
+}
+
+static bool find(msr::value_t layout, memory_type_t type, bool leaf, entry_bits_t& out) {
+    size_t index;
+    if (!index_of(layout, type, index, leaf ? entries : non_leaf_entries)) {
+        return false;
+    }
+
+    out = entry_bits_t::from_index(index);
+    return true;
+}
+
+size_t entry_bits_t::index() const {
+    return (pat ? 4 : 0) | (pcd ? 2 : 0) | (pwt ? 1 : 0);
+}
+
+entry_bits_t entry_bits_t::from_index(size_t index) {
+    return {(index & 4) != 0, (index & 2) != 0, (index & 1) != 0};
+}
+
+bool is_supported() {
+    return cpu_features().has<features::pat>();
+}
+
+memory_type_t type_at(msr::value_t layout, size_t index) {
+    return static_cast<memory_type_t>((layout >> (index * bits_per_entry)) & entry_type_mask);
+}
+
+bool index_of(msr::value_t layout, memory_type_t type, size_t& index, size_t limit) {
+    for (size_t i = 0; i < limit && i < entries; ++i) {
+        if (type_at(layout, i) == type) {
+            index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+msr::value_t current_layout() {
+    return x86::read<msr::ia32_pat_t>().raw;
+}
+
+bool install(msr::value_t layout) {
+    if (!is_supported() || (layout & reserved_mask) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < entries; ++i) {
+        if (!is_valid_type(type_at(layout, i))) {
+            return false;
+        }
+    }
+
+    const auto state = cache::enter_no_fill_mode();
+    x86::write(msr::ia32_pat_t(layout));
+    cache::exit_no_fill_mode(state);
+
+    return true;
+}
+
+bool set_memory_type(msr::value_t layout, paging::ia32e::pml4e_t& entry, memory_type_t type) {
+    entry_bits_t bits{};
+    if (!find(layout, type, false, bits)) {
+        return false;
+    }
+
+    set_non_leaf_bits(entry.bits, bits);
+    return true;
+}
+
+bool set_memory_type(msr::value_t layout, paging::ia32e::pdpte_t& entry, memory_type_t type) {
+    entry_bits_t bits{};
+    if (!find(layout, type, entry.is_huge(), bits)) {
+        return false;
+    }
+
+    if (entry.is_huge()) {
+        set_leaf_bits(entry.huge, bits);
+    } else {
+        set_non_leaf_bits(entry.small, bits);
+    }
+    return true;
+}
+
+bool set_memory_type(msr::value_t layout, paging::ia32e::pde_t& entry, memory_type_t type) {
+    entry_bits_t bits{};
+    if (!find(layout, type, entry.is_large(), bits)) {
+        return false;
+    }
+
+    if (entry.is_large()) {
+        set_leaf_bits(entry.large, bits);
+    } else {
+        set_non_leaf_bits(entry.small, bits);
+    }
+    return true;
+}
+
+bool set_memory_type(msr::value_t layout, paging::ia32e::pte_t& entry, memory_type_t type) {
+    entry_bits_t bits{};
+    if (!find(layout, type, true, bits)) {
+        return false;
+    }
+
+    set_leaf_bits(entry.bits, bits);
+    return true;
+}
+
+memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pml4e_t& entry) {
+    return type_at(layout, non_leaf_index(entry.bits));
+}
+
+memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pdpte_t& entry) {
+    if (entry.is_huge()) {
+        return type_at(layout, leaf_index(entry.huge));
+    }
+
+    return type_at(layout, non_leaf_index(entry.small));
+}
+
+memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pde_t& entry) {
+    if (entry.is_large()) {
+        return type_at(layout, leaf_index(entry.large));
+    }
+
+    return type_at(layout, non_leaf_index(entry.small));
+}
+
+memory_type_t memory_type(msr::value_t layout, const paging::ia32e::pte_t& entry) {
+    return type_at(layout, leaf_index(entry.bits));
+}
+
+memory_type_t effective_type(memory_type_t mtrr_type, memory_type_t pat_type) {
+    // [SDM 3 11.5.2.2 "Table 11-7"]
+    if (mtrr_type == mtrr::memory_type_invalid) {
+        return mtrr::memory_type_invalid;
+    }
+
+    // UC and WC in the pat override the mtrr
+    if (pat_type == memory_type_t::uncacheable || pat_type == memory_type_t::write_coombining) {
+        return pat_type;
+    }
+
+    if (pat_type == uncached_minus) {
+        if (mtrr_type == memory_type_t::write_coombining || mtrr_type == memory_type_t::write_protected) {
+            return memory_type_t::write_coombining;
+        }
+        return memory_type_t::uncacheable;
+    }
+
+    switch (mtrr_type) {
+        case memory_type_t::uncacheable:
+            return memory_type_t::uncacheable;
+        case memory_type_t::write_coombining:
+            return pat_type == memory_type_t::writeback ?
+                   memory_type_t::write_coombining :
+                   memory_type_t::uncacheable;
+        case memory_type_t::write_through:
+            return pat_type == memory_type_t::writeback ? memory_type_t::write_through : pat_type;
+        case memory_type_t::writeback:
+            return pat_type;
+        case memory_type_t::write_protected:
+            return pat_type == memory_type_t::writeback ? memory_type_t::write_protected : pat_type;
+        default:
+            return mtrr::memory_type_invalid;
+    }
+}
+
+memory_type_t effective_type(const mtrr::mtrr_cache_t& mtrrs, physical_address_t address, size_t size, memory_type_t pat_type) {
+    const auto mtrr_type = size <= paging::page_size_4k ?
+            mtrrs.type_for_4k(address) :
+            mtrrs.type_for_range(address, size);
+
+    return effective_type(mtrr_type, pat_type);
+}
+
+}
@@ -0,0 +1,245 @@
+
+#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
+#include "x86/pmu.h"
+
+
+namespace x86::pmu {
+
+// [SDM 4 "IA32_PERF_CAPABILITIES"]
+static constexpr uint64_t perf_capabilities_fw_write = bit(13);
+
+// bits of a fixed counter in ia32_fixed_ctr_ctrl [SDM 3 20.2.2]
+static constexpr size_t fixed_ctrl_bits = 4;
+static constexpr uint64_t fixed_ctrl_os = bit(0);
+static constexpr uint64_t fixed_ctrl_usr = bit(1);
+static constexpr uint64_t fixed_ctrl_pmi = bit(3);
+static constexpr uint64_t fixed_ctrl_mask = bit(fixed_ctrl_bits) - 1;
+
+static pmu_info_t g_info{};
+
+static uint64_t width_mask(uint8_t width) {
+    return width >= 64 ? ~0ull : bit(width) - 1;
+}
+
+static bool is_gp_valid(size_t index) {
+    return index < info().gp_count;
+}
+
+static bool is_fixed_valid(size_t index) {
+    return info().is_fixed_supported(index);
+}
+
+void pmu_info_t::load() {
+    *this = {};
+    loaded = true;
+
+    const auto& cpu = cpu_features();
+    if (!cpu.is_leaf_supported(0xa)) {
+        return;
+    }
+
+    const auto leaf = cpu.leaf<cpuid_eax0a_t>();
+    version = leaf.eax.bits.version;
+    if (version == 0) {
+        return;
+    }
+
+    gp_count = leaf.eax.bits.gp_counters;
+    gp_width = leaf.eax.bits.gp_width;
+    // only the first events_length bits of ebx are valid, the others are unavailable
+    unavailable_events = leaf.ebx.raw | ~static_cast<uint32_t>(width_mask(leaf.eax.bits.events_length));
+
+    if (version >= 2) {
+        fixed_count = leaf.edx.bits.fixed_counters;
+        fixed_width = leaf.edx.bits.fixed_width;
+    }
+    if (version >= 5) {
+        fixed_mask = leaf.ecx.raw;
+    }
+
+    if (cpu.has<features::pdcm>()) {
+        full_width_writes = (msr::read(perf_capabilities_msr_id) & perf_capabilities_fw_write) != 0;
+    }
+}
+
+bool pmu_info_t::is_event_supported(const event_t& event) const {
+    if (version == 0) {
+        return false;
+    }
+    if (event.cpuid_bit == not_architectural) {
+        return true;
+    }
+
+    return (unavailable_events & bit(event.cpuid_bit)) == 0;
+}
+
+bool pmu_info_t::is_fixed_supported(size_t index) const {
+    if (index >= max_fixed_counters) {
+        return false;
+    }
+
+    // [SDM 3 20.2.5] fixed counter N is supported if ecx[N] is set or edx[4:0] > N
+    return index < fixed_count || (fixed_mask & bit(index)) != 0;
+}
+
+counter_mask_t pmu_info_t::counters() const {
+    counter_mask_t mask = bit(gp_count) - 1;
+    for (size_t i = 0; i < max_fixed_counters; ++i) {
+        if (is_fixed_supported(i)) {
+            mask |= fixed_counter(i);
+        }
+    }
+
+    return mask;
+}
+
+const pmu_info_t& info() {
+    if (!g_info.loaded) {
+        g_info.load();
+    }
+
+    return g_info;
+}
+
+bool configure(size_t index, const event_t& event, count_mode_t mode, bool interrupt) {
+    if (!is_gp_valid(index) || !info().is_event_supported(event)) {
+        return false;
+    }
+
+    perfevtsel_t evtsel{};
+    evtsel.bits.event_select = event.event_select;
+    evtsel.bits.umask = event.umask;
+    evtsel.bits.os = (static_cast<uint8_t>(mode) & static_cast<uint8_t>(count_mode_t::kernel)) != 0;
+    evtsel.bits.usr = (static_cast<uint8_t>(mode) & static_cast<uint8_t>(count_mode_t::user)) != 0;
+    evtsel.bits.interrupt = interrupt;
+    // without ia32_perf_global_ctrl, the enable bit is what starts the counter
+    evtsel.bits.enable = info().version >= 2;
+
+    msr::write(perfevtsel_msr_id + index, evtsel.raw);
+    return true;
+}
+
+bool configure_fixed(size_t index, count_mode_t mode, bool interrupt) {
+    if (!is_fixed_valid(index)) {
+        return false;
+    }
+
+    uint64_t ctrl = 0;
+    if ((static_cast<uint8_t>(mode) & static_cast<uint8_t>(count_mode_t::kernel)) != 0) {
+        ctrl |= fixed_ctrl_os;
+    }
+    if ((static_cast<uint8_t>(mode) & static_cast<uint8_t>(count_mode_t::user)) != 0) {
+        ctrl |= fixed_ctrl_usr;
+    }
+    if (interrupt) {
+        ctrl |= fixed_ctrl_pmi;
+    }
+
+    auto fixed_ctrl = x86::read<msr::ia32_fixed_ctr_ctrl_t>();
+    fixed_ctrl.raw &= ~(fixed_ctrl_mask << (index * fixed_ctrl_bits));
+    fixed_ctrl.raw |= ctrl << (index * fixed_ctrl_bits);
+    x86::write(fixed_ctrl);
+    return true;
+}
+
+void reset(size_t index) {
+    if (!is_gp_valid(index)) {
+        return;
+    }
+
+    msr::write(perfevtsel_msr_id + index, 0);
+    msr::write(pmc_msr_id + index, 0);
+}
+
+void reset_fixed(size_t index) {
+    if (!is_fixed_valid(index)) {
+        return;
+    }
+
+    auto fixed_ctrl = x86::read<msr::ia32_fixed_ctr_ctrl_t>();
+    fixed_ctrl.raw &= ~(fixed_ctrl_mask << (index * fixed_ctrl_bits));
+    x86::write(fixed_ctrl);
+
+    msr::write(fixed_ctr_msr_id + index, 0);
+}
+
+void set_period(size_t index, uint64_t period) {
+    if (!is_gp_valid(index)) {
+        return;
+    }
+
+    const auto value = (0 - period) & width_mask(info().gp_width);
+    if (info().full_width_writes) {
+        msr::write(full_width_pmc_msr_id + index, value);
+    } else {
+        msr::write(pmc_msr_id + index, value);
+    }
+}
+
+void set_fixed_period(size_t index, uint64_t period) {
+    if (!is_fixed_valid(index)) {
+        return;
+    }
+
+    msr::write(fixed_ctr_msr_id + index, (0 - period) & width_mask(info().fixed_width));
+}
+
+void start(counter_mask_t counters) {
+    counters &= info().counters();
+
+    if (info().version >= 2) {
+        auto global_ctrl = x86::read<msr::ia32_pref_global_ctrl_t>();
+        global_ctrl.raw |= counters;
+        x86::write(global_ctrl);
+        return;
+    }
+
+    for (size_t i = 0; i < info().gp_count; ++i) {
+        if ((counters & gp_counter(i)) != 0) {
+            perfevtsel_t evtsel{};
+            evtsel.raw = msr::read(perfevtsel_msr_id + i);
+            evtsel.bits.enable = true;
+            msr::write(perfevtsel_msr_id + i, evtsel.raw);
+        }
+    }
+}
+
+void stop(counter_mask_t counters) {
+    counters &= info().counters();
+
+    if (info().version >= 2) {
+        auto global_ctrl = x86::read<msr::ia32_pref_global_ctrl_t>();
+        global_ctrl.raw &= ~counters;
+        x86::write(global_ctrl);
+        return;
+    }
+
+    for (size_t i = 0; i < info().gp_count; ++i) {
+        if ((counters & gp_counter(i)) != 0) {
+            perfevtsel_t evtsel{};
+            evtsel.raw = msr::read(perfevtsel_msr_id + i);
+            evtsel.bits.enable = false;
+            msr::write(perfevtsel_msr_id + i, evtsel.raw);
+        }
+    }
+}
+
+counter_mask_t overflowed() {
+    if (info().version < 2) {
+        return 0;
+    }
+
+    return x86::read<msr::ia32_perf_global_status_t>().raw & info().counters();
+}
+
+void clear_overflow(counter_mask_t counters) {
+    if (info().version < 2) {
+        return;
+    }
+
+    msr::ia32_perf_global_ovf_ctrl_t ovf_ctrl(counters & info().counters());
+    x86::write(ovf_ctrl);
+}
+
+}
@@ -0,0 +1,357 @@
+
+#include "x86/atomic.h"
+#include "x86/apic.h"
+#include "x86/cr.h"
+#include "x86/cpu_features.h"
+#include "x86/msr.h"
+#include "x86/paging/paging.h"
+#include "x86/topology.h"
+#include "x86/tsc.h"
+#include "x86/smp.h"
+
+
+extern "C" const uint8_t x86_smp_trampoline_start[];
+extern "C" const uint8_t x86_smp_trampoline_params[];
+extern "C" const uint8_t x86_smp_trampoline_gdt[];
+extern "C" const uint8_t x86_smp_trampoline_long_mode[];
+extern "C" const uint8_t x86_smp_trampoline_end[];
+
+// the trampoline, copied to the startup page. the offsets of the params fields are
+// those of trampoline_params_t.
+// real mode (cs base is the page): loads the temporary gdt, cr4.pae, cr3 and efer.lme,
+// then sets cr0.pe and cr0.pg together and jumps to the 64 bit code segment of the
+// temporary gdt, which goes straight to long mode [SDM 3 9.8.5].
+// long mode: reads the apic id of the ap (as topology::current_x2apic_id), loads the
+// rest of the state, the final gdt/idt and segments, finds the index of the apic id in
+// the list and calls the entry with it, on the stack of that index. an ap which isn't
+// in the list halts before touching any stack. the params are addressed relative to
+// rip through a local label, so it is the copy which is read and not the original.
+asm(
+    ".pushsection .rodata\n"
+    ".balign 16\n"
+    ".globl x86_smp_trampoline_start\n"
+    "x86_smp_trampoline_start:\n"
+    ".code16\n"
+    "    jmp 1f\n"
+    ".balign 8\n"
+    ".globl x86_smp_trampoline_params\n"
+    "x86_smp_trampoline_params:\n"
+    ".Lx86_smp_trampoline_params:\n"
+    "    .skip 104\n"
+    ".globl x86_smp_trampoline_gdt\n"
+    "x86_smp_trampoline_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00af9a000000ffff\n"
+    "1:\n"
+    "    cli\n"
+    "    cld\n"
+    "    mov %cs, %ax\n"
+    "    mov %ax, %ds\n"
+    "    lgdtl (x86_smp_trampoline_params - x86_smp_trampoline_start)\n"
+    "    mov $0x20, %eax\n"
+    "    mov %eax, %cr4\n"
+    "    mov (x86_smp_trampoline_params - x86_smp_trampoline_start + 12), %eax\n"
+    "    mov %eax, %cr3\n"
+    "    mov $0xc0000080, %ecx\n"
+    "    mov (x86_smp_trampoline_params - x86_smp_trampoline_start + 16), %eax\n"
+    "    mov (x86_smp_trampoline_params - x86_smp_trampoline_start + 20), %edx\n"
+    "    wrmsr\n"
+    "    mov %cr0, %eax\n"
+    "    or $0x80000001, %eax\n"
+    "    mov %eax, %cr0\n"
+    "    ljmpl *(x86_smp_trampoline_params - x86_smp_trampoline_start + 6)\n"
+    ".code64\n"
+    ".globl x86_smp_trampoline_long_mode\n"
+    "x86_smp_trampoline_long_mode:\n"
+    "    xor %eax, %eax\n"
+    "    cpuid\n"
+    "    cmp $0xb, %eax\n"
+    "    jb 4f\n"
+    "    mov $0xb, %eax\n"
+    "    xor %ecx, %ecx\n"
+    "    cpuid\n"
+    "    test $0xffff, %ebx\n"
+    "    jz 4f\n"
+    "    mov %edx, %esi\n"
+    "    jmp 5f\n"
+    "4:\n"
+    "    mov $1, %eax\n"
+    "    cpuid\n"
+    "    shr $24, %ebx\n"
+    "    mov %ebx, %esi\n"
+    "5:\n"
+    "    lea .Lx86_smp_trampoline_params(%rip), %rbx\n"
+    "    mov 24(%rbx), %rax\n"
+    "    mov %rax, %cr0\n"
+    "    mov 32(%rbx), %rax\n"
+    "    mov %rax, %cr4\n"
+    "    lgdt 40(%rbx)\n"
+    "    lidt 50(%rbx)\n"
+    "    movzwl 62(%rbx), %eax\n"
+    "    mov %eax, %ds\n"
+    "    mov %eax, %es\n"
+    "    mov %eax, %ss\n"
+    "    xor %eax, %eax\n"
+    "    mov %eax, %fs\n"
+    "    mov %eax, %gs\n"
+    "    mov 88(%rbx), %rdi\n"
+    "    xor %ecx, %ecx\n"
+    "6:\n"
+    "    cmp 96(%rbx), %rcx\n"
+    "    jae 3f\n"
+    "    cmp %esi, (%rdi,%rcx,4)\n"
+    "    je 7f\n"
+    "    inc %rcx\n"
+    "    jmp 6b\n"
+    "7:\n"
+    "    mov %rcx, %r12\n"
+    "    lea 1(%rcx), %rax\n"
+    "    imul 72(%rbx), %rax\n"
+    "    add 64(%rbx), %rax\n"
+    "    mov %rax, %rsp\n"
+    "    movzwl 60(%rbx), %eax\n"
+    "    push %rax\n"
+    "    lea 2f(%rip), %rax\n"
+    "    push %rax\n"
+    "    lretq\n"
+    "2:\n"
+    "    xor %ebp, %ebp\n"
+    "    mov %r12, %rdi\n"
+    "    call *80(%rbx)\n"
+    "3:\n"
+    "    cli\n"
+    "    hlt\n"
+    "    jmp 3b\n"
+    ".globl x86_smp_trampoline_end\n"
+    "x86_smp_trampoline_end:\n"
+    ".popsection\n"
+);
+
+
+namespace x86::smp {
+
+// selector of the 64 bit code segment in the temporary gdt
+static constexpr uint16_t trampoline_code_selector = 0x08;
+static constexpr uint16_t trampoline_gdt_limit = 2 * sizeof(uint64_t) - 1;
+// [SDM 3 2.2.1 "Figure 2-6"] efer.lma is set by the cpu
+static constexpr uint64_t efer_lma = bit(10);
+static constexpr uint64_t efer_lme = bit(8);
+// [SDM 3 10.6.2.1] physical destination in xapic mode
+static constexpr uint32_t xapic_max_id = 0xff;
+
+#pragma pack(push, 1)
+
+struct trampoline_params_t {
+    // read in real mode
+    uint16_t gdt32_limit;
+    uint32_t gdt32_base;
+    uint32_t long_mode_entry;
+    uint16_t long_mode_selector;
+    uint32_t cr3;
+    uint32_t efer_low;
+    uint32_t efer_high;
+    // read in long mode
+    uint64_t cr0;
+    uint64_t cr4;
+    segments::table_register_t gdtr;
+    segments::table_register_t idtr;
+    uint16_t code_selector;
+    uint16_t data_selector;
+    uint64_t stacks;
+    uint64_t stack_size;
+    uint64_t entry;
+    // the ap with apic_ids[i] takes the stack i
+    uint64_t apic_ids;
+    uint64_t count;
+};
+static_assert(sizeof(trampoline_params_t) == 104, "sizeof(trampoline_params_t)");
+static_assert(__builtin_offsetof(trampoline_params_t, cr3) == 12, "offsetof(trampoline_params_t, cr3)");
+static_assert(__builtin_offsetof(trampoline_params_t, cr0) == 24, "offsetof(trampoline_params_t, cr0)");
+static_assert(__builtin_offsetof(trampoline_params_t, idtr) == 50, "offsetof(trampoline_params_t, idtr)");
+static_assert(__builtin_offsetof(trampoline_params_t, apic_ids) == 88, "offsetof(trampoline_params_t, apic_ids)");
+
+#pragma pack(pop)
+
+struct state_t {
+    size_t count;
+    callback_t callback;
+    void* context;
+    volatile bool started[topology::max_cpus];
+    volatile uint32_t started_count;
+    volatile uint32_t finished_count;
+};
+
+static state_t g_state{};
+
+static size_t trampoline_offset(const uint8_t* label) {
+    return static_cast<size_t>(label - x86_smp_trampoline_start);
+}
+
+static segments::table_register_t read_idtr() {
+    segments::table_register_t idtr{};
+    asm volatile("sidt %0" : "=m"(idtr));
+    return idtr;
+}
+
+static void delay(uint64_t ns) {
+    const auto end = tsc::read() + tsc::to_cycles(ns);
+    while (tsc::read() < end) {
+        atomic::pause();
+    }
+}
+
+// xapic mode destinations are 8 bits
+static bool are_addressable(const uint32_t* apic_ids, size_t count) {
+    if (apic::current_mode() == apic::mode_t::x2apic) {
+        return true;
+    }
+
+    for (size_t cpu = 0; cpu < count; ++cpu) {
+        if (apic_ids[cpu] > xapic_max_id) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool is_valid(const config_t& config) {
+    return config.trampoline < trampoline_limit &&
+           paging::is_page_aligned(config.trampoline) &&
+           config.cr3 < cr3_limit &&
+           paging::is_page_aligned(config.cr3) &&
+           config.stacks != nullptr &&
+           config.stack_size != 0 &&
+           (reinterpret_cast<uint64_t>(config.stacks) % stack_alignment) == 0 &&
+           (config.stack_size % stack_alignment) == 0 &&
+           config.callback != nullptr;
+}
+
+// called on the ap by the trampoline, on the stack of its index in the apic ids
+static void ap_main(size_t cpu) {
+    g_state.started[cpu] = true;
+    atomic::fetchadd32(&g_state.started_count, 1);
+
+    g_state.callback(cpu, g_state.context);
+
+    atomic::fetchadd32(&g_state.finished_count, 1);
+}
+
+static void write_params(const config_t& config, const uint32_t* apic_ids, size_t count, trampoline_params_t& params) {
+    const auto efer = (config.efer & ~efer_lma) | efer_lme;
+
+    params.gdt32_limit = trampoline_gdt_limit;
+    params.gdt32_base = static_cast<uint32_t>(config.trampoline + trampoline_offset(x86_smp_trampoline_gdt));
+    params.long_mode_entry = static_cast<uint32_t>(config.trampoline + trampoline_offset(x86_smp_trampoline_long_mode));
+    params.long_mode_selector = trampoline_code_selector;
+    params.cr3 = static_cast<uint32_t>(config.cr3);
+    params.efer_low = static_cast<uint32_t>(efer);
+    params.efer_high = static_cast<uint32_t>(efer >> 32);
+    params.cr0 = config.cr0;
+    params.cr4 = config.cr4;
+    params.gdtr = config.gdtr;
+    params.idtr = config.idtr;
+    params.code_selector = config.code_selector;
+    params.data_selector = config.data_selector;
+    params.stacks = reinterpret_cast<uint64_t>(config.stacks);
+    params.stack_size = config.stack_size;
+    params.entry = reinterpret_cast<uint64_t>(&ap_main);
+    params.apic_ids = reinterpret_cast<uint64_t>(apic_ids);
+    params.count = count;
+}
+
+size_t trampoline_size() {
+    return trampoline_offset(x86_smp_trampoline_end);
+}
+
+config_t current_config(physical_address_t trampoline, void* stacks, size_t stack_size, callback_t callback, void* context) {
+    config_t config{};
+    config.trampoline = trampoline;
+    config.cr3 = x86::read<cr3_t>().raw & ~(paging::page_size - 1);
+    config.cr0 = x86::read<cr0_t>().raw;
+    config.cr4 = x86::read<cr4_t>().raw;
+    config.efer = x86::read<msr::ia32_efer_t>().raw;
+    config.gdtr = x86::read<segments::gdtr_t>();
+    config.idtr = read_idtr();
+    config.code_selector = x86::read<segments::cs_t>().value;
+    config.data_selector = x86::read<segments::ss_t>().value;
+    config.stacks = stacks;
+    config.stack_size = stack_size;
+    config.callback = callback;
+    config.context = context;
+    config.timeout_ns = default_timeout_ns;
+    return config;
+}
+
+size_t start(const config_t& config, const uint32_t* apic_ids, size_t count) {
+    if (!is_valid(config) ||
+        count > topology::max_cpus ||
+        !are_addressable(apic_ids, count) ||
+        tsc::frequency().hz == 0) {
+        return 0;
+    }
+
+    // loaded here rather than by the aps all at once
+    load_cpu_features();
+
+    // identity mapped, as the page is below 1M
+    auto page = reinterpret_cast<uint8_t*>(config.trampoline);
+    memcpy(page, x86_smp_trampoline_start, trampoline_size());
+    write_params(config, apic_ids, count, *reinterpret_cast<trampoline_params_t*>(page + trampoline_offset(x86_smp_trampoline_params)));
+
+    g_state.count = count;
+    g_state.callback = config.callback;
+    g_state.context = config.context;
+    for (size_t cpu = 0; cpu < count; ++cpu) {
+        g_state.started[cpu] = false;
+    }
+    g_state.started_count = 0;
+    g_state.finished_count = 0;
+    atomic::mb();
+
+    const auto self = topology::current_x2apic_id();
+    const auto vector = static_cast<uint8_t>(config.trampoline >> paging::page_bits_4k);
+    uint32_t expected = 0;
+
+    // every step goes to all the aps before the delay, so they all start together
+    for (size_t cpu = 0; cpu < count; ++cpu) {
+        if (apic_ids[cpu] != self) {
+            apic::send_init(apic_ids[cpu]);
+            expected++;
+        }
+    }
+    delay(init_delay_ns);
+
+    for (size_t cpu = 0; cpu < count; ++cpu) {
+        if (apic_ids[cpu] != self) {
+            apic::send_startup(apic_ids[cpu], vector);
+        }
+    }
+    delay(startup_delay_ns);
+
+    // the second startup is ignored by aps which are already running
+    for (size_t cpu = 0; cpu < count; ++cpu) {
+        if (apic_ids[cpu] != self && !g_state.started[cpu]) {
+            apic::send_startup(apic_ids[cpu], vector);
+        }
+    }
+
+    const auto end = tsc::read() + tsc::to_cycles(config.timeout_ns);
+    while (g_state.started_count < expected && tsc::read() < end) {
+        atomic::pause();
+    }
+
+    return g_state.started_count;
+}
+
+bool is_started(size_t cpu) {
+    return cpu < g_state.count && g_state.started[cpu];
+}
+
+void wait_for_callbacks() {
+    while (g_state.finished_count < g_state.started_count) {
+        atomic::pause();
+    }
+}
+
+}
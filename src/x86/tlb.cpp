@@ -0,0 +1,273 @@
+
+#include "x86/atomic.h"
+#include "x86/apic.h"
+#include "x86/cr.h"
+#include "x86/interrupts.h"
+#include "x86/tlb.h"
+
+
+namespace x86::tlb {
+
+void flush() {
+    x86::write(x86::read<cr3_t>());
+}
+
+void flush_global() {
+    // [SDM 3 4.10.4.1] changing CR4.PGE flushes everything
+    auto cr4 = x86::read<cr4_t>();
+    if (!cr4.bits.page_global_enable) {
+        flush();
+        return;
+    }
+
+    auto without_global = cr4;
+    without_global.bits.page_global_enable = false;
+    x86::write(without_global);
+    x86::write(cr4);
+}
+
+request_t::request_t()
+    : m_ranges()
+    , m_count(0)
+    , m_pages(0)
+    , m_full(false)
+    , m_global(false)
+    , m_pending(0)
+{}
+
+void request_t::add(linear_address_t base, size_t pages) {
+    if (m_full || pages == 0) {
+        return;
+    }
+
+    auto start = base & ~(paging::page_size - 1);
+    auto end = start + pages * paging::page_size;
+
+    for (size_t i = 0; i < m_count;) {
+        const auto& range = m_ranges[i];
+        const auto range_end = range.base + range.pages * paging::page_size;
+        if (start > range_end || range.base > end) {
+            ++i;
+            continue;
+        }
+
+        start = start < range.base ? start : range.base;
+        end = end > range_end ? end : range_end;
+        m_pages -= range.pages;
+        m_ranges[i] = m_ranges[--m_count];
+        // the grown range may now touch ranges which were skipped
+        i = 0;
+    }
+
+    if (m_count == max_ranges) {
+        m_full = true;
+        return;
+    }
+
+    m_ranges[m_count++] = {start, (end - start) / paging::page_size};
+    m_pages += (end - start) / paging::page_size;
+    if (m_pages > full_flush_threshold) {
+        m_full = true;
+    }
+}
+
+void request_t::add_all() {
+    m_full = true;
+}
+
+void request_t::set_global(bool global) {
+    m_global = global;
+}
+
+void request_t::reset() {
+    m_count = 0;
+    m_pages = 0;
+    m_full = false;
+    m_global = false;
+}
+
+bool request_t::is_full() const {
+    return m_full;
+}
+
+bool request_t::is_global() const {
+    return m_global;
+}
+
+size_t request_t::pages() const {
+    return m_pages;
+}
+
+size_t request_t::range_count() const {
+    return m_count;
+}
+
+const range_t& request_t::range(size_t index) const {
+    return m_ranges[index];
+}
+
+void request_t::invalidate() const {
+    if (m_full) {
+        if (m_global) {
+            flush_global();
+        } else {
+            flush();
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < m_count; ++i) {
+        for (size_t page = 0; page < m_ranges[i].pages; ++page) {
+            invlpg(m_ranges[i].base + page * paging::page_size);
+        }
+    }
+}
+
+// each slot holds its sequence: index for a free slot of this round, index + 1 once
+// filled, index + capacity once consumed (free for the next round).
+queue_t::queue_t()
+    : m_slots()
+    , m_enqueue(0)
+    , m_dequeue(0)
+    , m_notified(0) {
+    for (size_t i = 0; i < capacity; ++i) {
+        m_slots[i].sequence = i;
+    }
+}
+
+bool queue_t::push(request_t* request) {
+    auto position = m_enqueue;
+    slot_t* slot;
+    while (true) {
+        slot = &m_slots[position % capacity];
+        const auto sequence = slot->sequence;
+        const auto difference = static_cast<int64_t>(sequence - position);
+
+        if (difference == 0) {
+            if (atomic::cmpswap64(&m_enqueue, position, position + 1)) {
+                break;
+            }
+            position = m_enqueue;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = m_enqueue;
+        }
+    }
+
+    slot->request = request;
+    atomic::wmb();
+    slot->sequence = position + 1;
+    return true;
+}
+
+request_t* queue_t::pop() {
+    const auto position = m_dequeue;
+    auto& slot = m_slots[position % capacity];
+    if (slot.sequence != position + 1) {
+        return nullptr;
+    }
+
+    auto request = slot.request;
+    slot.sequence = position + capacity;
+    m_dequeue = position + 1;
+    return request;
+}
+
+shootdown_t::shootdown_t(queue_t* queues, const uint32_t* apic_ids, size_t cpu_count, uint8_t vector)
+    : m_queues(queues)
+    , m_apic_ids(apic_ids)
+    , m_cpu_count(cpu_count)
+    , m_vector(vector)
+{}
+
+void shootdown_t::flush(size_t self, const topology::cpu_mask_t& targets, request_t& request) {
+    // the shootdown handler of this cpu must not run in the middle of handle(), which
+    // pops the same single-consumer queue
+    const auto flags = interrupts::save_and_disable();
+
+    uint32_t pending = 0;
+    for (size_t cpu = 0; cpu < m_cpu_count; ++cpu) {
+        if (cpu != self && targets.test(cpu)) {
+            pending++;
+        }
+    }
+    request.m_pending = pending;
+
+    for (size_t cpu = 0; cpu < m_cpu_count; ++cpu) {
+        if (cpu == self || !targets.test(cpu)) {
+            continue;
+        }
+
+        auto& queue = m_queues[cpu];
+        while (!queue.push(&request)) {
+            handle(self);
+            atomic::pause();
+        }
+
+        // the target clears this before draining, so either it sees the request or
+        // it gets another ipi
+        if (atomic::swap32(&queue.m_notified, 1) == 0) {
+            apic::send_fixed_ipi(m_apic_ids[cpu], m_vector);
+        }
+    }
+
+    if (targets.test(self)) {
+        request.invalidate();
+    }
+
+    while (request.m_pending != 0) {
+        handle(self);
+        atomic::pause();
+    }
+
+    interrupts::restore(flags);
+}
+
+void shootdown_t::handle(size_t self) {
+    auto& queue = m_queues[self];
+    atomic::swap32(&queue.m_notified, 0);
+
+    request_t* requests[queue_t::capacity];
+    size_t count = 0;
+    size_t pages = 0;
+    bool full = false;
+    bool global = false;
+
+    // requests pushed after this are left for the ipi their initiator sends
+    while (count < queue_t::capacity) {
+        auto request = queue.pop();
+        if (request == nullptr) {
+            break;
+        }
+
+        requests[count++] = request;
+        pages += request->m_pages;
+        full |= request->m_full;
+        global |= request->m_global;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    // the requests are invalidated together, so their pages add up
+    if (full || pages > full_flush_threshold) {
+        if (global) {
+            tlb::flush_global();
+        } else {
+            tlb::flush();
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            requests[i]->invalidate();
+        }
+    }
+
+    // the initiator may reuse the request once acknowledged
+    for (size_t i = 0; i < count; ++i) {
+        atomic::fetchadd32(&requests[i]->m_pending, static_cast<uint32_t>(-1));
+    }
+}
+
+}
@@ -0,0 +1,179 @@
+
+#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
+#include "x86/topology.h"
+
+
+namespace x86::topology {
+
+// bound on the subleaves walked, in case the cpu never reports the terminating one
+static constexpr cpuid_t max_subleaves = 32;
+
+// bits needed to hold ids [0, count)
+static uint8_t bits_for(uint32_t count) {
+    if (count <= 1) {
+        return 0;
+    }
+
+    return static_cast<uint8_t>(bit_scan_reverse(count - 1) + 1);
+}
+
+static uint32_t field(uint32_t x2apic_id, uint8_t low, uint8_t high) {
+    const auto value = static_cast<uint64_t>(x2apic_id) >> low;
+    return static_cast<uint32_t>(value & (bit(high - low) - 1));
+}
+
+// [SDM 3 9.9.1] leaf 0xb/0x1f are supported if subleaf 0 reports processors
+template<typename _t>
+static bool is_extended_leaf_supported() {
+    const auto& cpu = cpu_features();
+    if (!cpu.is_leaf_supported(_t::leaf)) {
+        return false;
+    }
+
+    return cpu.leaf<_t>().ebx.bits.logical_processors != 0;
+}
+
+// [SDM 3 9.9.1] each level reports the shift of the x2apic id which gives the id of
+// the next level, the last level gives the package id.
+template<typename _t>
+static void read_extended_levels(apic_id_layout_t& layout) {
+    uint8_t previous_shift = 0;
+    bool has_die = false;
+
+    // only subleaf 0 is in the database, the levels are walked with cpuid
+    for (cpuid_t subleaf = 0; subleaf < max_subleaves; ++subleaf) {
+        const auto regs = cpuid<_t>(subleaf);
+        const auto type = static_cast<level_type_t>(regs.ecx.bits.level_type);
+        if (type == level_type_t::invalid) {
+            break;
+        }
+
+        if (type == level_type_t::smt) {
+            layout.core_shift = regs.eax.bits.shift;
+        } else if (type == level_type_t::die) {
+            layout.die_shift = previous_shift;
+            has_die = true;
+        }
+
+        previous_shift = regs.eax.bits.shift;
+    }
+
+    layout.package_shift = previous_shift;
+    if (!has_die) {
+        layout.die_shift = layout.package_shift;
+    }
+}
+
+// [SDM 3 9.9.4] processors without leaf 0xb report the addressable ids per package
+// in leaf 1 and the addressable cores per package in leaf 4.
+static void read_legacy_levels(apic_id_layout_t& layout) {
+    const auto& cpu = cpu_features();
+
+    uint32_t logical = 1;
+    if (cpu.has<features::htt>()) {
+        logical = cpu.leaf<cpuid_eax01_t>().ebx.bits.max_logical_processors;
+    }
+
+    uint32_t cores = 1;
+    if (cpu.is_leaf_supported(0x4)) {
+        cores = cpu.leaf<cpuid_eax04_t>().eax.bits.max_core_ids + 1;
+    }
+    if (cores > logical) {
+        logical = cores;
+    }
+
+    layout.core_shift = bits_for(logical / cores);
+    layout.package_shift = layout.core_shift + bits_for(cores);
+    layout.die_shift = layout.package_shift;
+}
+
+static void read_caches(apic_id_layout_t& layout) {
+    if (!is_cpuid_leaf_supported(0x4)) {
+        return;
+    }
+
+    // like the levels, the caches are walked with cpuid
+    for (cpuid_t subleaf = 0; subleaf < max_subleaves; ++subleaf) {
+        const auto regs = cpuid<cpuid_eax04_t>(subleaf);
+        const auto type = static_cast<cache_type_t>(regs.eax.bits.cache_type);
+        if (type == cache_type_t::null) {
+            break;
+        }
+        if (type == cache_type_t::instruction) {
+            continue;
+        }
+
+        const auto shift = bits_for(regs.eax.bits.max_sharing_ids + 1);
+        if (regs.eax.bits.cache_level == 2) {
+            layout.l2_shift = shift;
+            layout.has_l2 = true;
+        } else if (regs.eax.bits.cache_level == 3) {
+            layout.l3_shift = shift;
+            layout.has_l3 = true;
+        }
+    }
+}
+
+// the ids differ between the cpus, so they are read with cpuid on the current one
+uint32_t current_x2apic_id() {
+    if (is_extended_leaf_supported<cpuid_eax0b_t>()) {
+        return cpuid<cpuid_eax0b_t>(0).edx.bits.x2apic_id;
+    }
+
+    return cpuid<cpuid_eax01_t>().ebx.bits.initial_apic_id;
+}
+
+apic_id_layout_t read_layout() {
+    apic_id_layout_t layout{};
+
+    if (is_extended_leaf_supported<cpuid_eax1f_t>()) {
+        read_extended_levels<cpuid_eax1f_t>(layout);
+    } else if (is_extended_leaf_supported<cpuid_eax0b_t>()) {
+        read_extended_levels<cpuid_eax0b_t>(layout);
+    } else {
+        read_legacy_levels(layout);
+    }
+
+    read_caches(layout);
+
+    return layout;
+}
+
+bool build(const apic_id_layout_t& layout, const uint32_t* x2apic_ids, cpu_topology_t* cpus, size_t count) {
+    if (count > max_cpus) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto id = x2apic_ids[i];
+        auto& cpu = cpus[i];
+
+        cpu.x2apic_id = id;
+        cpu.package = static_cast<uint32_t>(static_cast<uint64_t>(id) >> layout.package_shift);
+        cpu.die = field(id, layout.die_shift, layout.package_shift);
+        cpu.core = field(id, layout.core_shift, layout.die_shift);
+        cpu.thread = field(id, 0, layout.core_shift);
+        cpu.l2_sharing.clear_all();
+        cpu.l3_sharing.clear_all();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto id = static_cast<uint64_t>(x2apic_ids[i]);
+
+        for (size_t j = 0; j < count; ++j) {
+            const auto other = static_cast<uint64_t>(x2apic_ids[j]);
+
+            if (layout.has_l2 && (id >> layout.l2_shift) == (other >> layout.l2_shift)) {
+                cpus[i].l2_sharing.set(j);
+            }
+            if (layout.has_l3 && (id >> layout.l3_shift) == (other >> layout.l3_shift)) {
+                cpus[i].l3_sharing.set(j);
+            }
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,201 @@
+
+#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
+#include "x86/msr.h"
+#include "x86/tsc.h"
+
+
+namespace x86::tsc {
+
+static constexpr uint64_t ns_per_second = 1000000000ull;
+static constexpr uint64_t hz_per_mhz = 1000000ull;
+static constexpr uint64_t khz = 1000ull;
+
+// [SDM 4 "MSR_PLATFORM_INFO"] bus clock of the ratio, since sandy bridge
+static constexpr uint64_t platform_info_bus_hz = 100 * hz_per_mhz;
+// [SDM 4 2.1 "Table 2-1"] family 6 models (with the extended model) whose ratio is in
+// units of platform_info_bus_hz: sandy bridge to broadwell, and the skylake/kaby lake
+// cores which don't enumerate the crystal. earlier cores don't have the msr (#GP) or
+// have a 133MHz bus, and the atoms have a bus clock of their own.
+static constexpr uint8_t platform_info_models[] = {
+    0x2a, 0x2d,             // sandy bridge
+    0x3a, 0x3e,             // ivy bridge
+    0x3c, 0x3f, 0x45, 0x46, // haswell
+    0x3d, 0x47, 0x4f, 0x56, // broadwell
+    0x4e, 0x5e, 0x55,       // skylake
+    0x8e, 0x9e              // kaby lake, coffee lake
+};
+
+// no tsc runs faster, it bounds the wait for a reference which doesn't advance
+static constexpr uint64_t max_tsc_hz = 10000000000ull;
+
+// vmware/kvm timing leaf, eax is the tsc frequency in khz
+static constexpr cpuid_t hypervisor_base_leaf = 0x40000000;
+static constexpr cpuid_t hypervisor_timing_leaf = 0x40000010;
+
+// "GenuineIntel" in ebx, edx, ecx of leaf 0
+static constexpr uint32_t intel_ebx = 0x756e6547;
+static constexpr uint32_t intel_edx = 0x49656e69;
+static constexpr uint32_t intel_ecx = 0x6c65746e;
+
+static frequency_t g_frequency{};
+static converter_t g_converter{};
+
+static uint64_t from_crystal() {
+    const auto& cpu = cpu_features();
+    if (!cpu.is_leaf_supported(0x15)) {
+        return 0;
+    }
+
+    const auto leaf = cpu.leaf<cpuid_eax15_t>();
+    if (leaf.eax.bits.denominator == 0 || leaf.ebx.bits.numerator == 0 || leaf.ecx.bits.crystal_hz == 0) {
+        return 0;
+    }
+
+    return mul_div(leaf.ecx.bits.crystal_hz, leaf.ebx.bits.numerator, leaf.eax.bits.denominator);
+}
+
+// [SDM 2 "CPUID" Table 3-8, leaf 0x15] when the crystal isn't enumerated, the tsc runs at
+// the base frequency.
+static uint64_t from_base_frequency() {
+    const auto& cpu = cpu_features();
+    if (!cpu.is_leaf_supported(0x15) || !cpu.is_leaf_supported(0x16)) {
+        return 0;
+    }
+    if (cpu.leaf<cpuid_eax15_t>().ebx.bits.numerator == 0) {
+        return 0;
+    }
+
+    return cpu.leaf<cpuid_eax16_t>().eax.bits.base_mhz * hz_per_mhz;
+}
+
+static uint64_t from_hypervisor() {
+    if (!cpu_features().has<features::hypervisor>()) {
+        return 0;
+    }
+    // the hypervisor leaves aren't in the database
+    if (cpuid(hypervisor_base_leaf).eax < hypervisor_timing_leaf) {
+        return 0;
+    }
+
+    return cpuid(hypervisor_timing_leaf).eax * khz;
+}
+
+static bool is_platform_info_model(uint8_t model) {
+    for (const auto known : platform_info_models) {
+        if (known == model) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint64_t from_platform_info() {
+    // the msr is model specific, and hypervisors rarely emulate it
+    const auto& cpu = cpu_features();
+    const auto vendor = cpu.leaf(0x0);
+    if (vendor.ebx != intel_ebx || vendor.edx != intel_edx || vendor.ecx != intel_ecx) {
+        return 0;
+    }
+    if (cpu.has<features::hypervisor>()) {
+        return 0;
+    }
+
+    const auto version = cpu.leaf<cpuid_eax01_t>().eax.bits;
+    if (version.family_id != 6) {
+        return 0;
+    }
+
+    if (!is_platform_info_model(static_cast<uint8_t>(version.model | (version.extended_model_id << 4)))) {
+        return 0;
+    }
+
+    return x86::read<msr::msr_platform_info_t>().bits.max_non_turbo_ratio * platform_info_bus_hz;
+}
+
+bool is_invariant() {
+    return cpu_features().has<features::invariant_tsc>();
+}
+
+frequency_t discover_frequency() {
+    if (const auto hz = from_crystal(); hz != 0) {
+        return {hz, frequency_source_t::crystal};
+    }
+    if (const auto hz = from_base_frequency(); hz != 0) {
+        return {hz, frequency_source_t::base_frequency};
+    }
+    if (const auto hz = from_hypervisor(); hz != 0) {
+        return {hz, frequency_source_t::hypervisor};
+    }
+    if (const auto hz = from_platform_info(); hz != 0) {
+        return {hz, frequency_source_t::platform_info};
+    }
+
+    return {0, frequency_source_t::none};
+}
+
+uint64_t calibrate(uint64_t (*reference)(), uint64_t reference_hz, uint64_t reference_ticks) {
+    if (reference_hz == 0 || reference_ticks == 0) {
+        return 0;
+    }
+
+    // the measurement (and the first edge) takes reference_ticks + 1 ticks at most
+    const auto limit = read() + mul_div(reference_ticks + 1, max_tsc_hz, reference_hz);
+
+    // start on a tick edge, so a partial first tick isn't measured
+    const auto first = reference();
+    auto start_ticks = reference();
+    while (start_ticks == first) {
+        if (read() > limit) {
+            return 0;
+        }
+        start_ticks = reference();
+    }
+    const auto start = read_ordered();
+
+    auto ticks = start_ticks;
+    while (ticks - start_ticks < reference_ticks) {
+        if (read() > limit) {
+            return 0;
+        }
+        ticks = reference();
+    }
+    const auto end = read_ordered();
+
+    return mul_div(end - start, reference_hz, ticks - start_ticks);
+}
+
+converter_t::converter_t(uint64_t frequency)
+    : m_frequency(frequency)
+    , m_to_ns(frequency == 0 ? 0 : mul_div(ns_per_second, bit(shift), frequency))
+    , m_to_cycles(mul_div(frequency, bit(shift), ns_per_second))
+{}
+
+uint64_t converter_t::frequency() const {
+    return m_frequency;
+}
+
+bool initialize() {
+    set_frequency(discover_frequency());
+    return g_frequency.hz != 0;
+}
+
+void set_frequency(const frequency_t& frequency) {
+    g_frequency = frequency;
+    g_converter = converter_t(frequency.hz);
+}
+
+const frequency_t& frequency() {
+    return g_frequency;
+}
+
+uint64_t to_ns(uint64_t cycles) {
+    return g_converter.to_ns(cycles);
+}
+
+uint64_t to_cycles(uint64_t ns) {
+    return g_converter.to_cycles(ns);
+}
+
+}
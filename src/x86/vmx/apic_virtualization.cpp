@@ -0,0 +1,175 @@
+
+#include "x86/bitmap.h"
+#include "x86/atomic.h"
+#include "x86/vmx/apic_virtualization.h"
+
+
+namespace x86::vmx {
+
+// vector registers (isr/tmr/irr) are 8 32 bit registers, each vector_register_stride apart
+static volatile uint32_t* vector_register(const virtual_apic_page_t& page, apic::register_t base, uint8_t vector) {
+    const auto offset = static_cast<uint16_t>(base) + (vector / 32) * apic::vector_register_stride;
+    return reinterpret_cast<volatile uint32_t*>(const_cast<uint8_t*>(&page.data[offset]));
+}
+
+static int highest_vector(const virtual_apic_page_t& page, apic::register_t base) {
+    for (int i = 7; i >= 0; --i) {
+        const auto value = *vector_register(page, base, i * 32);
+        if (value != 0) {
+            return i * 32 + static_cast<int>(bit_scan_reverse(value));
+        }
+    }
+
+    return -1;
+}
+
+uint32_t virtual_apic_page_t::read(apic::register_t reg) const {
+    return *reinterpret_cast<const volatile uint32_t*>(&data[static_cast<uint16_t>(reg)]);
+}
+
+void virtual_apic_page_t::write(apic::register_t reg, uint32_t value) {
+    *reinterpret_cast<volatile uint32_t*>(&data[static_cast<uint16_t>(reg)]) = value;
+}
+
+uint8_t virtual_apic_page_t::tpr() const {
+    return read(apic::register_t::tpr) & 0xff;
+}
+
+void virtual_apic_page_t::tpr(uint8_t value) {
+    write(apic::register_t::tpr, value);
+}
+
+bool virtual_apic_page_t::test_irr(uint8_t vector) const {
+    return (*vector_register(*this, apic::register_t::irr0, vector) & bit(vector % 32)) != 0;
+}
+
+void virtual_apic_page_t::set_irr(uint8_t vector) {
+    x86::atomic::or32(vector_register(*this, apic::register_t::irr0, vector), bit(vector % 32));
+}
+
+void virtual_apic_page_t::clear_irr(uint8_t vector) {
+    x86::atomic::and32(vector_register(*this, apic::register_t::irr0, vector), ~bit(vector % 32));
+}
+
+bool virtual_apic_page_t::test_isr(uint8_t vector) const {
+    return (*vector_register(*this, apic::register_t::isr0, vector) & bit(vector % 32)) != 0;
+}
+
+void virtual_apic_page_t::merge_irr(const uint64_t (&requests)[4]) {
+    for (size_t i = 0; i < 8; ++i) {
+        const auto value = static_cast<uint32_t>(requests[i / 2] >> ((i % 2) * 32));
+        if (value != 0) {
+            x86::atomic::or32(vector_register(*this, apic::register_t::irr0, i * 32), value);
+        }
+    }
+}
+
+int virtual_apic_page_t::highest_irr() const {
+    return highest_vector(*this, apic::register_t::irr0);
+}
+
+int virtual_apic_page_t::highest_isr() const {
+    return highest_vector(*this, apic::register_t::isr0);
+}
+
+void eoi_exit_bitmap_t::clear_all() {
+    bitmap::fill(words, array_size(words), false);
+}
+
+void eoi_exit_bitmap_t::set(uint8_t vector) {
+    bitmap::set(words, vector);
+}
+
+void eoi_exit_bitmap_t::clear(uint8_t vector) {
+    bitmap::clear(words, vector);
+}
+
+bool eoi_exit_bitmap_t::test(uint8_t vector) const {
+    return bitmap::test(words, vector);
+}
+
+instruction_result_t eoi_exit_bitmap_t::write_to_vmcs() const {
+    constexpr field_t fields[] = {
+            field_t::ctrl_eoi_exit_bitmap_0,
+            field_t::ctrl_eoi_exit_bitmap_1,
+            field_t::ctrl_eoi_exit_bitmap_2,
+            field_t::ctrl_eoi_exit_bitmap_3,
+    };
+
+    for (size_t i = 0; i < array_size(fields); ++i) {
+        const auto result = vmwrite(fields[i], words[i]);
+        if (result != instruction_result_t::success) {
+            return result;
+        }
+    }
+
+    return instruction_result_t::success;
+}
+
+void enable_apic_virtualization(pin_based_exec_controls_t& pin_based,
+                                processor_based_exec_controls_t& controls,
+                                secondary_processor_based_exec_controls_t& secondary,
+                                bool x2apic) {
+    // [SDM 3 26.2.1.1]
+    pin_based.bits.external_interrupt_exiting = true;
+
+    controls.bits.use_tpr_shadow = true;
+    controls.bits.activate_secondary_controls = true;
+
+    secondary.bits.virtualize_x2apic = x2apic;
+    secondary.bits.virtualize_apic_accesses = !x2apic;
+    secondary.bits.apic_register_virtualization = true;
+    secondary.bits.virtual_interrupt_delivery = true;
+}
+
+bool passthrough_virtualized_x2apic(msr_bitmap_t& bitmap) {
+    // [SDM 3 29.5]
+    if (!bitmap.passthrough_read(apic::x2apic_msr_base, apic::x2apic_msr_base + 0xff)) {
+        return false;
+    }
+
+    return bitmap.passthrough_write(apic::x2apic_msr(apic::register_t::tpr)) &&
+           bitmap.passthrough_write(apic::x2apic_msr(apic::register_t::eoi)) &&
+           bitmap.passthrough_write(apic::x2apic_msr(apic::register_t::self_ipi));
+}
+
+instruction_result_t set_virtual_apic_address(physical_address_t address) {
+    return vmwrite(field_t::ctrl_virtual_apic_address, address);
+}
+
+instruction_result_t set_apic_access_address(physical_address_t address) {
+    return vmwrite(field_t::ctrl_apic_access_address, address);
+}
+
+instruction_result_t read_guest_interrupt_status(guest_interrupt_status_t& status) {
+    uint64_t value;
+    const auto result = vmread(field_t::guest_interrupt_status, value);
+    if (result == instruction_result_t::success) {
+        status.raw = static_cast<uint16_t>(value);
+    }
+
+    return result;
+}
+
+instruction_result_t write_guest_interrupt_status(const guest_interrupt_status_t& status) {
+    return vmwrite(field_t::guest_interrupt_status, status.raw);
+}
+
+instruction_result_t update_rvi(const virtual_apic_page_t& page) {
+    guest_interrupt_status_t status{};
+    auto result = read_guest_interrupt_status(status);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    const auto highest = page.highest_irr();
+    const uint8_t rvi = highest < 0 ? 0 : static_cast<uint8_t>(highest);
+    if (status.bits.rvi == rvi) {
+        return instruction_result_t::success;
+    }
+
+    status.bits.rvi = rvi;
+    return write_guest_interrupt_status(status);
+}
+
+}
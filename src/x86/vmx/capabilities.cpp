@@ -0,0 +1,87 @@
+
+#include "x86/vmx/capabilities.h"
+
+#ifdef X86_VMX_MOCK
+#include "x86/vmx/mock.h"
+#endif
+
+
+namespace x86::vmx {
+
+static capabilities_t g_capabilities{};
+
+// [SDM 3 24.6.2 "Table 24-6"]
+static constexpr uint32_t activate_secondary_controls_bit = 31;
+// [SDM 3 24.6.2 "Table 24-7"]
+static constexpr uint32_t enable_ept_bit = 1;
+static constexpr uint32_t enable_vpid_bit = 5;
+static constexpr uint32_t enable_vm_functions_bit = 13;
+
+template<typename _msr>
+static void load_msr(capabilities_t& caps) {
+    caps.msrs[_msr::id - capabilities_first_msr] = x86::read<_msr>().raw;
+}
+
+bool capabilities_t::are_true_controls_supported() const {
+    return basic().bits.vm_ctrls_fixed != 0;
+}
+
+bool capabilities_t::are_secondary_controls_supported() const {
+    const auto procbased = are_true_controls_supported() ?
+            get<msr::ia32_vmx_true_procbased_ctls_t>().bits.allowed1 :
+            get<msr::ia32_vmx_procbased_ctls_t>().bits.allowed1;
+    return (procbased & bit(activate_secondary_controls_bit)) != 0;
+}
+
+void load_capabilities() {
+    capabilities_t caps{};
+
+#ifdef X86_VMX_MOCK
+    mock::fill_capabilities(caps);
+#else
+    load_msr<msr::ia32_vmx_basic_t>(caps);
+    load_msr<msr::ia32_vmx_pinbased_ctls_t>(caps);
+    load_msr<msr::ia32_vmx_procbased_ctls_t>(caps);
+    load_msr<msr::ia32_vmx_exit_ctls_t>(caps);
+    load_msr<msr::ia32_vmx_entry_ctls_t>(caps);
+    load_msr<msr::ia32_vmx_misc_t>(caps);
+    load_msr<msr::ia32_vmx_cr0_fixed0_t>(caps);
+    load_msr<msr::ia32_vmx_cr0_fixed1_t>(caps);
+    load_msr<msr::ia32_vmx_cr4_fixed0_t>(caps);
+    load_msr<msr::ia32_vmx_cr4_fixed1_t>(caps);
+
+    // [SDM 3 A.1]
+    if (caps.are_true_controls_supported()) {
+        load_msr<msr::ia32_vmx_true_pinbased_ctls_t>(caps);
+        load_msr<msr::ia32_vmx_true_procbased_ctls_t>(caps);
+        load_msr<msr::ia32_vmx_true_exit_ctls_t>(caps);
+        load_msr<msr::ia32_vmx_true_entry_ctls_t>(caps);
+    }
+
+    // [SDM 3 A.3.3, A.10, A.11]
+    if (caps.are_secondary_controls_supported()) {
+        load_msr<msr::ia32_vmx_procbased_ctls2_t>(caps);
+
+        const auto secondary = caps.get<msr::ia32_vmx_procbased_ctls2_t>().bits.allowed1;
+        if (secondary & (bit(enable_ept_bit) | bit(enable_vpid_bit))) {
+            load_msr<msr::ia32_vmx_ept_vpid_cap_t>(caps);
+        }
+        if (secondary & bit(enable_vm_functions_bit)) {
+            load_msr<msr::ia32_vmx_vmfunc_t>(caps);
+        }
+    }
+#endif
+
+    caps.loaded = true;
+    g_capabilities = caps;
+}
+
+const capabilities_t& capabilities() {
+    if (!g_capabilities.loaded) {
+        load_capabilities();
+    }
+
+    return g_capabilities;
+}
+
+}
@@ -0,0 +1,355 @@
+
+#include "x86/vmx/guest_cpuid.h"
+
+
+namespace x86::vmx {
+
+static constexpr size_t max_subleaves = 64;
+
+// [SDM 2 "CPUID" Table 3-8]
+static constexpr uint32_t leaf1_ebx_logical_count_shift = 16;
+static constexpr uint32_t leaf1_ebx_apic_id_shift = 24;
+static constexpr uint32_t leaf1_ecx_vmx = 1u << 5;
+static constexpr uint32_t leaf1_ecx_osxsave = 1u << 27;
+static constexpr uint32_t leaf1_ecx_hypervisor = 1u << 31;
+static constexpr uint32_t leaf1_edx_htt = 1u << 28;
+static constexpr uint32_t leaf7_ebx_sgx = 1u << 2;
+static constexpr uint32_t leaf7_ebx_rdt_m = 1u << 12;
+static constexpr uint32_t leaf7_ebx_rdt_a = 1u << 15;
+// topology level types, leaf 0xb/0x1f ecx[15:8]
+static constexpr uint32_t level_type_smt = 1;
+static constexpr uint32_t level_type_core = 2;
+
+static constexpr cpuid_t topology_leaves[] = {0xb, 0x1f};
+
+static bool is_topology_leaf(cpuid_t leaf) {
+    return leaf == 0xb || leaf == 0x1f;
+}
+
+// leaves which the guest can't use without more virtualization work (RDT monitoring,
+// RDT allocation, SGX), reported as not supported
+static bool is_hidden_leaf(cpuid_t leaf) {
+    return leaf == 0xf || leaf == 0x10 || leaf == 0x12;
+}
+
+static size_t highest_bit(uint64_t value) {
+    size_t index = 0;
+    while (value >>= 1) {
+        index++;
+    }
+    return index;
+}
+
+// reads the subleaves of a host leaf, returns their count.
+static size_t read_host_leaf(cpuid_t leaf, cpuid_regs_t (&subleaves)[max_subleaves], bool& indexed) {
+    subleaves[0] = cpuid(leaf, 0);
+    indexed = true;
+
+    size_t count = 1;
+    switch (leaf) {
+        case 0x4:
+            // deterministic cache parameters, until cache type null (eax[4:0] = 0)
+            if ((subleaves[0].eax & 0x1f) == 0) {
+                break;
+            }
+            for (; count < max_subleaves; ++count) {
+                subleaves[count] = cpuid(leaf, count);
+                if ((subleaves[count].eax & 0x1f) == 0) {
+                    break;
+                }
+            }
+            break;
+        case 0x7:
+        case 0x14:
+        case 0x17:
+        case 0x18:
+        case 0x1d:
+        case 0x20:
+            // subleaf 0 eax is the max subleaf
+            count = subleaves[0].eax + 1;
+            break;
+        case 0xb:
+        case 0x1f:
+            // until level type invalid (ecx[15:8] = 0)
+            for (; count < max_subleaves; ++count) {
+                subleaves[count] = cpuid(leaf, count);
+                if (((subleaves[count].ecx >> 8) & 0xff) == 0) {
+                    break;
+                }
+            }
+            break;
+        case 0xd: {
+            // subleaves 0, 1 and one for each supported xcr0/xss component
+            const auto xss = cpuid(leaf, 1);
+            const auto components =
+                    (static_cast<uint64_t>(subleaves[0].edx) << 32) | subleaves[0].eax |
+                    (static_cast<uint64_t>(xss.edx) << 32) | xss.ecx;
+            count = highest_bit(components) + 1;
+            if (count < 2) {
+                count = 2;
+            }
+            break;
+        }
+        default:
+            if (is_hidden_leaf(leaf)) {
+                subleaves[0] = {};
+            } else {
+                indexed = false;
+            }
+            break;
+    }
+
+    if (count > max_subleaves) {
+        count = max_subleaves;
+    }
+    for (size_t subleaf = 1; subleaf < count; ++subleaf) {
+        if (leaf != 0x4 && !is_topology_leaf(leaf)) {
+            subleaves[subleaf] = cpuid(leaf, subleaf);
+        }
+    }
+
+    return count;
+}
+
+static cpuid_t min_leaf(cpuid_t host_max, cpuid_t table_max, cpuid_t policy_max) {
+    auto max = host_max < table_max ? host_max : table_max;
+    if (policy_max != 0 && policy_max < max) {
+        max = policy_max;
+    }
+    return max;
+}
+
+guest_cpuid_t::guest_cpuid_t()
+    : m_slots{}
+    , m_entries{}
+    , m_entry_count(0)
+    , m_max_basic(0)
+    , m_max_hypervisor(0)
+    , m_max_extended(0)
+{}
+
+bool guest_cpuid_t::build(const guest_cpuid_policy_t& policy) {
+    m_entry_count = 0;
+    m_max_hypervisor = 0;
+    m_max_extended = 0;
+    for (auto& slot : m_slots) {
+        slot = {};
+    }
+
+    m_max_basic = min_leaf(cpuid(guest_cpuid_basic_first).eax,
+                           guest_cpuid_basic_first + basic_leaves - 1,
+                           policy.max_basic_leaf);
+    for (cpuid_t leaf = guest_cpuid_basic_first; leaf <= m_max_basic; ++leaf) {
+        if (!add_leaf(leaf)) {
+            return false;
+        }
+    }
+    find(guest_cpuid_basic_first, 0)->eax = m_max_basic;
+
+    const auto host_max_extended = cpuid(guest_cpuid_extended_first).eax;
+    if (host_max_extended >= guest_cpuid_extended_first) {
+        m_max_extended = min_leaf(host_max_extended,
+                                  guest_cpuid_extended_first + extended_leaves - 1,
+                                  policy.max_extended_leaf);
+        for (cpuid_t leaf = guest_cpuid_extended_first; leaf <= m_max_extended; ++leaf) {
+            if (!add_leaf(leaf)) {
+                return false;
+            }
+        }
+        find(guest_cpuid_extended_first, 0)->eax = m_max_extended;
+    }
+
+    if (policy.hypervisor_leaves) {
+        const auto max_leaf = min_leaf(policy.hypervisor_max_leaf,
+                                       guest_cpuid_hypervisor_first + hypervisor_leaves - 1,
+                                       0);
+        const auto last = max_leaf > guest_cpuid_hypervisor_first ? max_leaf : guest_cpuid_hypervisor_first;
+        if (m_entry_count + (last - guest_cpuid_hypervisor_first + 1) > max_entries) {
+            return false;
+        }
+
+        m_max_hypervisor = last;
+        for (cpuid_t leaf = guest_cpuid_hypervisor_first; leaf <= last; ++leaf) {
+            const cpuid_regs_t regs{};
+            add_leaf(leaf, &regs, 1, false);
+        }
+    }
+
+    apply_features(policy);
+    apply_hypervisor(policy);
+    apply_topology(policy);
+
+    return true;
+}
+
+bool guest_cpuid_t::set(cpuid_t leaf, cpuid_t subleaf, const cpuid_regs_t& regs) {
+    auto entry = find(leaf, subleaf);
+    if (entry == nullptr) {
+        return false;
+    }
+
+    *entry = regs;
+    return true;
+}
+
+cpuid_regs_t guest_cpuid_t::lookup(cpuid_t leaf, cpuid_t subleaf, const guest_cpuid_state_t& state) const {
+    const auto& slot = m_slots[slot_of(leaf)];
+    // out of range leaves are answered by the max basic leaf
+    const auto effective_leaf = contains(leaf) ? leaf : m_max_basic;
+
+    cpuid_regs_t regs{};
+    if (!slot.indexed) {
+        regs = m_entries[slot.first];
+    } else if (subleaf < slot.count) {
+        regs = m_entries[slot.first + subleaf];
+    } else if (is_topology_leaf(effective_leaf)) {
+        // invalid level still reports the level number [SDM 2 "CPUID" Table 3-8]
+        regs.ecx = subleaf & 0xff;
+    }
+
+    if (effective_leaf == 0x1) {
+        regs.ebx = (regs.ebx & ~(0xffu << leaf1_ebx_apic_id_shift)) | ((state.apic_id & 0xff) << leaf1_ebx_apic_id_shift);
+        regs.ecx = state.osxsave ? (regs.ecx | leaf1_ecx_osxsave) : (regs.ecx & ~leaf1_ecx_osxsave);
+    } else if (is_topology_leaf(effective_leaf)) {
+        regs.edx = state.apic_id;
+    }
+
+    return regs;
+}
+
+bool guest_cpuid_t::add_leaf(cpuid_t leaf) {
+    cpuid_regs_t subleaves[max_subleaves];
+    bool indexed = false;
+    const auto count = read_host_leaf(leaf, subleaves, indexed);
+    return add_leaf(leaf, subleaves, count, indexed);
+}
+
+bool guest_cpuid_t::add_leaf(cpuid_t leaf, const cpuid_regs_t* subleaves, size_t count, bool indexed) {
+    if (m_entry_count + count > max_entries) {
+        return false;
+    }
+
+    auto& slot = m_slots[slot_of(leaf)];
+    slot.first = static_cast<uint16_t>(m_entry_count);
+    slot.count = static_cast<uint8_t>(count);
+    slot.indexed = indexed;
+
+    for (size_t i = 0; i < count; ++i) {
+        m_entries[m_entry_count++] = subleaves[i];
+    }
+
+    return true;
+}
+
+cpuid_regs_t* guest_cpuid_t::find(cpuid_t leaf, cpuid_t subleaf) {
+    if (!contains(leaf)) {
+        return nullptr;
+    }
+
+    const auto& slot = m_slots[slot_of(leaf)];
+    if (slot.indexed ? subleaf >= slot.count : subleaf != 0) {
+        return nullptr;
+    }
+
+    return &m_entries[slot.first + subleaf];
+}
+
+bool guest_cpuid_t::contains(cpuid_t leaf) const {
+    return leaf <= m_max_basic ||
+           (leaf >= guest_cpuid_hypervisor_first && leaf <= m_max_hypervisor) ||
+           (leaf >= guest_cpuid_extended_first && leaf <= m_max_extended);
+}
+
+size_t guest_cpuid_t::slot_of(cpuid_t leaf) const {
+    if (leaf >= guest_cpuid_extended_first && leaf <= m_max_extended) {
+        return basic_leaves + hypervisor_leaves + (leaf - guest_cpuid_extended_first);
+    }
+    if (leaf >= guest_cpuid_hypervisor_first && leaf <= m_max_hypervisor) {
+        return basic_leaves + (leaf - guest_cpuid_hypervisor_first);
+    }
+    if (leaf <= m_max_basic) {
+        return leaf - guest_cpuid_basic_first;
+    }
+
+    return m_max_basic - guest_cpuid_basic_first;
+}
+
+void guest_cpuid_t::apply_features(const guest_cpuid_policy_t& policy) {
+    auto leaf1 = find(0x1, 0);
+    if (leaf1 != nullptr && policy.hide_vmx) {
+        leaf1->ecx &= ~leaf1_ecx_vmx;
+    }
+
+    auto leaf7 = find(0x7, 0);
+    if (leaf7 != nullptr) {
+        leaf7->ebx &= ~(leaf7_ebx_sgx | leaf7_ebx_rdt_m | leaf7_ebx_rdt_a);
+    }
+}
+
+void guest_cpuid_t::apply_hypervisor(const guest_cpuid_policy_t& policy) {
+    if (!policy.hypervisor_leaves) {
+        return;
+    }
+
+    auto leaf1 = find(0x1, 0);
+    if (leaf1 != nullptr) {
+        leaf1->ecx |= leaf1_ecx_hypervisor;
+    }
+
+    auto info = find(guest_cpuid_hypervisor_first, 0);
+    info->eax = m_max_hypervisor;
+    info->ebx = policy.hypervisor_signature[0];
+    info->ecx = policy.hypervisor_signature[1];
+    info->edx = policy.hypervisor_signature[2];
+}
+
+void guest_cpuid_t::apply_topology(const guest_cpuid_policy_t& policy) {
+    if (policy.vcpu_count == 0) {
+        return;
+    }
+
+    uint32_t core_shift = 0;
+    while ((1u << core_shift) < policy.vcpu_count) {
+        core_shift++;
+    }
+    const uint32_t max_core_ids = 1u << core_shift;
+
+    auto leaf1 = find(0x1, 0);
+    if (leaf1 != nullptr) {
+        const auto logical_count = max_core_ids > 0xff ? 0xff : max_core_ids;
+        leaf1->ebx = (leaf1->ebx & ~(0xffu << leaf1_ebx_logical_count_shift)) |
+                     (logical_count << leaf1_ebx_logical_count_shift);
+        leaf1->edx = policy.vcpu_count > 1 ? (leaf1->edx | leaf1_edx_htt) : (leaf1->edx & ~leaf1_edx_htt);
+    }
+
+    // deterministic cache parameters: eax[25:14] max ids sharing the cache - 1,
+    // eax[31:26] max core ids in the package - 1. only the last level is shared.
+    if (m_max_basic >= 0x4) {
+        const auto& slot = m_slots[slot_of(0x4)];
+        const auto cores = (max_core_ids - 1) > 0x3f ? 0x3f : (max_core_ids - 1);
+        for (size_t i = 0; i < slot.count; ++i) {
+            auto& regs = m_entries[slot.first + i];
+            const auto level = (regs.eax >> 5) & 0x7;
+            const auto sharing = level >= 3 ? ((max_core_ids - 1) & 0xfff) : 0;
+            regs.eax = (regs.eax & 0x3fff) | (sharing << 14) | (cores << 26);
+        }
+    }
+
+    // extended topology: smt level with one thread, core level with all the vcpus
+    for (cpuid_t leaf : topology_leaves) {
+        if (leaf > m_max_basic) {
+            continue;
+        }
+
+        auto& slot = m_slots[slot_of(leaf)];
+        if (slot.count < 2) {
+            continue;
+        }
+
+        m_entries[slot.first] = {0, 1, (level_type_smt << 8) | 0, 0};
+        m_entries[slot.first + 1] = {core_shift, policy.vcpu_count, (level_type_core << 8) | 1, 0};
+        slot.count = 2;
+    }
+}
+
+}
@@ -0,0 +1,114 @@
+
+#include "x86/vmx/io_bitmap.h"
+
+
+namespace x86::vmx {
+
+static void update_bitmap(uint64_t* words, size_t first, size_t count, bool intercept) {
+    if (intercept) {
+        bitmap::set_range(words, first, count);
+    } else {
+        bitmap::clear_range(words, first, count);
+    }
+}
+
+static void update(io_bitmap_t& bitmap, size_t first, size_t last, bool intercept) {
+    if (first < io_bitmap_ports_in_bitmap) {
+        const auto last_in_a = last < io_bitmap_ports_in_bitmap ? last : io_bitmap_ports_in_bitmap - 1;
+        update_bitmap(bitmap.a, first, last_in_a - first + 1, intercept);
+        first = last_in_a + 1;
+    }
+
+    if (first <= last) {
+        update_bitmap(bitmap.b,
+                      first - io_bitmap_ports_in_bitmap,
+                      last - first + 1,
+                      intercept);
+    }
+}
+
+static bool all_words_equal(const uint64_t* words, size_t count, uint64_t value) {
+    for (size_t i = 0; i < count; ++i) {
+        if (words[i] != value) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void io_bitmap_t::intercept_all() {
+    bitmap::fill(a, words_in_bitmap, true);
+    bitmap::fill(b, words_in_bitmap, true);
+}
+
+void io_bitmap_t::passthrough_all() {
+    bitmap::fill(a, words_in_bitmap, false);
+    bitmap::fill(b, words_in_bitmap, false);
+}
+
+void io_bitmap_t::intercept(port_t port) {
+    update(*this, port, port, true);
+}
+
+void io_bitmap_t::passthrough(port_t port) {
+    update(*this, port, port, false);
+}
+
+void io_bitmap_t::intercept(port_t first, port_t last) {
+    if (first > last) {
+        return;
+    }
+
+    update(*this, first, last, true);
+}
+
+void io_bitmap_t::passthrough(port_t first, port_t last) {
+    if (first > last) {
+        return;
+    }
+
+    update(*this, first, last, false);
+}
+
+bool io_bitmap_t::is_intercepted(port_t port, size_t access_size) const {
+    const auto last = static_cast<size_t>(port) + access_size - 1;
+    if (last >= io_bitmap_port_count) {
+        return true;
+    }
+
+    for (size_t current = port; current <= last; ++current) {
+        const auto in_b = current >= io_bitmap_ports_in_bitmap;
+        const auto words = in_b ? b : a;
+        if (bitmap::test(words, current & (io_bitmap_ports_in_bitmap - 1))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool io_bitmap_t::is_all_intercepted() const {
+    return all_words_equal(a, words_in_bitmap, ~0ull) &&
+           all_words_equal(b, words_in_bitmap, ~0ull);
+}
+
+bool io_bitmap_t::is_all_passthrough() const {
+    return all_words_equal(a, words_in_bitmap, 0) &&
+           all_words_equal(b, words_in_bitmap, 0);
+}
+
+void io_bitmap_t::configure_controls(processor_based_exec_controls_t& controls) const {
+    if (is_all_intercepted()) {
+        controls.bits.unconditional_io_exiting = true;
+        controls.bits.use_io_bitmaps = false;
+    } else if (is_all_passthrough()) {
+        controls.bits.unconditional_io_exiting = false;
+        controls.bits.use_io_bitmaps = false;
+    } else {
+        controls.bits.unconditional_io_exiting = false;
+        controls.bits.use_io_bitmaps = true;
+    }
+}
+
+}
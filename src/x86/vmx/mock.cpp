@@ -0,0 +1,392 @@
+
+#include "x86/paging/paging.h"
+#include "x86/vmx/vmx.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/mock.h"
+
+
+namespace x86::vmx::mock {
+
+static constexpr physical_address_t no_vmcs = static_cast<physical_address_t>(-1);
+static constexpr uint32_t data_magic = 0x4b434f4d; // "MOCK"
+static constexpr size_t max_fields = 254;
+
+#pragma pack(push, 1)
+
+// the implementation specific part of the vmcs region, as kept by the model
+struct vmcs_data_t {
+    struct entry_t {
+        uint32_t field;
+        uint32_t used;
+        uint64_t value;
+    };
+
+    uint32_t magic;
+    uint32_t launched;
+    entry_t entries[max_fields];
+};
+static_assert(sizeof(vmcs_data_t) <= sizeof(vmstruct_t::data), "sizeof(vmcs_data_t)");
+
+#pragma pack(pop)
+
+struct cpu_t {
+    bool in_vmx_operation;
+    physical_address_t vmxon_region;
+    physical_address_t current;
+    stats_t stats;
+};
+
+static cpu_t g_cpu{false, 0, no_vmcs, {}};
+
+static vmstruct_t* to_vmstruct(physical_address_t address) {
+    return reinterpret_cast<vmstruct_t*>(address);
+}
+
+static vmcs_data_t* to_data(physical_address_t address) {
+    return reinterpret_cast<vmcs_data_t*>(to_vmstruct(address)->data);
+}
+
+static bool is_valid_address(physical_address_t address) {
+    return address != 0 && (address & (x86::paging::page_size_4k - 1)) == 0;
+}
+
+static void initialize_data(vmcs_data_t* data) {
+    data->magic = data_magic;
+    data->launched = false;
+    for (auto& entry : data->entries) {
+        entry.field = 0;
+        entry.used = false;
+        entry.value = 0;
+    }
+}
+
+// open addressing over the encoding (without the access type bit)
+static vmcs_data_t::entry_t* find_entry(vmcs_data_t* data, uint32_t field, bool create) {
+    const auto key = field & ~1u;
+    auto index = (key * 2654435761u) % max_fields;
+    for (size_t i = 0; i < max_fields; ++i) {
+        auto& entry = data->entries[index];
+        if (entry.used && entry.field == key) {
+            return &entry;
+        }
+        if (!entry.used) {
+            if (!create) {
+                return nullptr;
+            }
+
+            entry.field = key;
+            entry.used = true;
+            entry.value = 0;
+            return &entry;
+        }
+
+        index = (index + 1) % max_fields;
+    }
+
+    return nullptr;
+}
+
+static void store(uint32_t field, uint64_t value) {
+    auto entry = find_entry(to_data(g_cpu.current), field, true);
+    if (entry != nullptr) {
+        entry->value = value;
+    }
+}
+
+static instruction_result_t fail_valid(instruction_error_t error) {
+    store(static_cast<uint32_t>(field_t::vm_instruction_error), static_cast<uint64_t>(error));
+    return instruction_result_t::vm_fail_valid;
+}
+
+// [SDM 3 30.2] VMfailInvalid if there is no current vmcs, VMfailValid otherwise
+static instruction_result_t fail(instruction_error_t error) {
+    if (g_cpu.current == no_vmcs) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    return fail_valid(error);
+}
+
+// [SDM 3 24.11.2]
+static bool is_valid_field(uint32_t field) {
+    if ((field & ~0x7fffu) != 0 || (field & bit(12)) != 0) {
+        return false;
+    }
+
+    // high access is only for 64 bit fields
+    const auto width = (field >> 13) & 0x3;
+    return (field & 1) == 0 || width == 1;
+}
+
+static uint64_t width_mask(uint32_t field) {
+    if (field & 1) {
+        return 0xffffffff;
+    }
+
+    switch ((field >> 13) & 0x3) {
+        case 0: return 0xffff;
+        case 2: return 0xffffffff;
+        default: return static_cast<uint64_t>(-1);
+    }
+}
+
+template<typename _msr>
+static void set(capabilities_t& caps, msr::value_t value) {
+    caps.msrs[_msr::id - capabilities_first_msr] = value;
+}
+
+void reset() {
+    g_cpu = {false, 0, no_vmcs, {}};
+}
+
+const stats_t& stats() {
+    return g_cpu.stats;
+}
+
+bool set_field(uint32_t field, uint64_t value) {
+    if (g_cpu.current == no_vmcs || !is_valid_field(field)) {
+        return false;
+    }
+
+    auto entry = find_entry(to_data(g_cpu.current), field, true);
+    if (entry == nullptr) {
+        return false;
+    }
+
+    if (field & 1) {
+        entry->value = (entry->value & 0xffffffff) | (value << 32);
+    } else {
+        entry->value = value & width_mask(field);
+    }
+
+    return true;
+}
+
+void fill_capabilities(capabilities_t& caps) {
+    msr::ia32_vmx_basic_t basic;
+    basic.bits.vmcs_revision = vmcs_revision;
+    basic.bits.vm_struct_size = sizeof(vmstruct_t);
+    basic.bits.vmcs_mem_type = 6; // write-back
+    basic.bits.ins_outs_vmexit_report = true;
+    basic.bits.vm_ctrls_fixed = true;
+    set<msr::ia32_vmx_basic_t>(caps, basic.raw);
+
+    // allowed0 = 0 (nothing fixed to 1), allowed1 = all
+    constexpr msr::value_t all_allowed = 0xffffffff00000000;
+    set<msr::ia32_vmx_pinbased_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_procbased_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_exit_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_entry_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_true_pinbased_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_true_procbased_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_true_exit_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_true_entry_ctls_t>(caps, all_allowed);
+    set<msr::ia32_vmx_procbased_ctls2_t>(caps, all_allowed);
+
+    msr::ia32_vmx_misc_t misc;
+    misc.bits.preemption_timer_rate_to_tsc = 5;
+    misc.bits.efer_lma_save = true;
+    misc.bits.activity_states_supported = 0x7;
+    misc.bits.cr3_target_values = 4;
+    misc.bits.vmwrite_to_all_fields = true;
+    misc.bits.software_inject = true;
+    set<msr::ia32_vmx_misc_t>(caps, misc.raw);
+
+    // PE, NE, PG must be 1 [SDM 3 A.7], VMXE must be 1 [SDM 3 A.8]
+    set<msr::ia32_vmx_cr0_fixed0_t>(caps, 0x80000021);
+    set<msr::ia32_vmx_cr0_fixed1_t>(caps, static_cast<msr::value_t>(-1));
+    set<msr::ia32_vmx_cr4_fixed0_t>(caps, 0x2000);
+    set<msr::ia32_vmx_cr4_fixed1_t>(caps, static_cast<msr::value_t>(-1));
+
+    // every ept/vpid capability
+    set<msr::ia32_vmx_ept_vpid_cap_t>(caps, static_cast<msr::value_t>(-1));
+    // eptp switching
+    set<msr::ia32_vmx_vmfunc_t>(caps, 1);
+}
+
+// [SDM 3 30.3 "VMXON"]
+instruction_result_t vmxon(physical_address_t address) {
+    if (g_cpu.in_vmx_operation) {
+        return fail(instruction_error_t::vmxon_in_vmx_root);
+    }
+    if (!is_valid_address(address) || to_vmstruct(address)->revision != vmcs_revision) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    g_cpu.in_vmx_operation = true;
+    g_cpu.vmxon_region = address;
+    g_cpu.current = no_vmcs;
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMXOFF"]
+instruction_result_t vmxoff() {
+    if (!g_cpu.in_vmx_operation) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    g_cpu.in_vmx_operation = false;
+    g_cpu.current = no_vmcs;
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMCLEAR"]
+instruction_result_t vmclear(physical_address_t address) {
+    g_cpu.stats.vmclear++;
+    if (!g_cpu.in_vmx_operation) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (!is_valid_address(address)) {
+        return fail(instruction_error_t::vmclear_invalid_address);
+    }
+    if (address == g_cpu.vmxon_region) {
+        return fail(instruction_error_t::vmclear_with_vmxon_pointer);
+    }
+
+    auto data = to_data(address);
+    if (data->magic != data_magic) {
+        // first use of the region
+        initialize_data(data);
+    }
+    data->launched = false;
+
+    if (g_cpu.current == address) {
+        g_cpu.current = no_vmcs;
+    }
+
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMPTRLD"]
+instruction_result_t vmptrld(physical_address_t address) {
+    g_cpu.stats.vmptrld++;
+    if (!g_cpu.in_vmx_operation) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (!is_valid_address(address)) {
+        return fail(instruction_error_t::vmptrld_invalid_address);
+    }
+    if (address == g_cpu.vmxon_region) {
+        return fail(instruction_error_t::vmptrld_with_vmxon_pointer);
+    }
+    if (to_vmstruct(address)->revision != vmcs_revision) {
+        return fail(instruction_error_t::vmptrld_with_incorrect_vmcs_revision);
+    }
+
+    auto data = to_data(address);
+    if (data->magic != data_magic) {
+        // wasn't vmcleared before use, the content is undefined
+        initialize_data(data);
+    }
+
+    g_cpu.current = address;
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMPTRST"]
+instruction_result_t vmptrst(physical_address_t& address) {
+    g_cpu.stats.vmptrst++;
+    if (!g_cpu.in_vmx_operation) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    address = g_cpu.current;
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMREAD"]
+instruction_result_t vmread(uint32_t field, uint64_t& value) {
+    g_cpu.stats.vmread++;
+    if (!g_cpu.in_vmx_operation || g_cpu.current == no_vmcs) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (!is_valid_field(field)) {
+        return fail_valid(instruction_error_t::vmreadwrite_unsupported_component);
+    }
+
+    const auto entry = find_entry(to_data(g_cpu.current), field, false);
+    const auto stored = entry != nullptr ? entry->value : 0;
+    value = (field & 1) ? stored >> 32 : stored;
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMWRITE"]
+instruction_result_t vmwrite(uint32_t field, uint64_t value) {
+    g_cpu.stats.vmwrite++;
+    if (!g_cpu.in_vmx_operation || g_cpu.current == no_vmcs) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (!is_valid_field(field)) {
+        return fail_valid(instruction_error_t::vmreadwrite_unsupported_component);
+    }
+
+    const auto read_only = ((field >> 10) & 0x3) == 1;
+    if (read_only && !capabilities().misc().bits.vmwrite_to_all_fields) {
+        return fail_valid(instruction_error_t::vmwrite_to_readonly);
+    }
+
+    if (!set_field(field, value)) {
+        // the model ran out of room for fields
+        return fail_valid(instruction_error_t::vmreadwrite_unsupported_component);
+    }
+
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "VMLAUNCH/VMRESUME"]
+instruction_result_t vmlaunch() {
+    g_cpu.stats.vmlaunch++;
+    if (!g_cpu.in_vmx_operation || g_cpu.current == no_vmcs) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    auto data = to_data(g_cpu.current);
+    if (data->launched) {
+        return fail_valid(instruction_error_t::vmlaunch_non_clear_vmcs);
+    }
+
+    data->launched = true;
+    return instruction_result_t::success;
+}
+
+instruction_result_t vmresume() {
+    g_cpu.stats.vmresume++;
+    if (!g_cpu.in_vmx_operation || g_cpu.current == no_vmcs) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    if (!to_data(g_cpu.current)->launched) {
+        return fail_valid(instruction_error_t::vmresume_non_launched_vmcs);
+    }
+
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "INVEPT"]
+instruction_result_t invept(uint64_t type) {
+    g_cpu.stats.invept++;
+    if (!g_cpu.in_vmx_operation) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (type != 1 && type != 2) {
+        return fail(instruction_error_t::invalid_op_to_invept_invpid);
+    }
+
+    return instruction_result_t::success;
+}
+
+// [SDM 3 30.3 "INVVPID"]
+instruction_result_t invvpid(uint64_t type) {
+    g_cpu.stats.invvpid++;
+    if (!g_cpu.in_vmx_operation) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (type > 3) {
+        return fail(instruction_error_t::invalid_op_to_invept_invpid);
+    }
+
+    return instruction_result_t::success;
+}
+
+}
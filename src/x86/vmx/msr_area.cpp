@@ -0,0 +1,184 @@
+
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/msr_area.h"
+
+
+namespace x86::vmx {
+
+static constexpr size_t msr_not_found = static_cast<size_t>(-1);
+
+size_t max_recommended_msr_area_count() {
+    const auto misc = capabilities().misc();
+    return 512 * (misc.bits.recommended_msr_store_size + 1);
+}
+
+bool is_msr_allowed_in_area(msr::id_t id) {
+    if (id == x86::msr::ia32_fs_base_t::id || id == x86::msr::ia32_gs_base_t::id) {
+        return false;
+    }
+    if (id >= 0x800 && id <= 0x8ff) {
+        return false;
+    }
+    if (id == x86::msr::ia32_smm_monitor_ctl_t::id || id == x86::msr::ia32_smbase_t::id) {
+        return false;
+    }
+
+    return true;
+}
+
+msr_switch_t::msr_switch_t(msr_area_t& guest_area, msr_area_t& host_area)
+    : m_guest_area(guest_area)
+    , m_host_area(host_area)
+    , m_count(0)
+    , m_capacity(array_size(guest_area.entries))
+    , m_attached(false) {
+    const auto recommended = max_recommended_msr_area_count();
+    if (recommended < m_capacity) {
+        m_capacity = recommended;
+    }
+}
+
+size_t msr_switch_t::count() const {
+    return m_count;
+}
+
+size_t msr_switch_t::capacity() const {
+    return m_capacity;
+}
+
+bool msr_switch_t::contains(msr::id_t id) const {
+    return find(id) != msr_not_found;
+}
+
+bool msr_switch_t::add(msr::id_t id, msr::value_t guest_value, msr::value_t host_value) {
+    if (!is_msr_allowed_in_area(id)) {
+        return false;
+    }
+
+    auto index = find(id);
+    const auto is_new = index == msr_not_found;
+    if (is_new) {
+        if (m_count >= m_capacity) {
+            return false;
+        }
+
+        index = m_count++;
+    }
+
+    m_guest_area.entries[index] = {id, 0, guest_value};
+    m_host_area.entries[index] = {id, 0, host_value};
+
+    if (write_counts() != instruction_result_t::success) {
+        if (is_new) {
+            m_count--;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool msr_switch_t::remove(msr::id_t id) {
+    const auto index = find(id);
+    if (index == msr_not_found) {
+        return false;
+    }
+
+    // order doesn't matter to us, so move the last entry into the hole
+    const auto guest_entry = m_guest_area.entries[index];
+    const auto host_entry = m_host_area.entries[index];
+    const auto last = --m_count;
+    m_guest_area.entries[index] = m_guest_area.entries[last];
+    m_host_area.entries[index] = m_host_area.entries[last];
+
+    if (write_counts() != instruction_result_t::success) {
+        // the last entry is still in place, only the hole is filled back
+        m_guest_area.entries[index] = guest_entry;
+        m_host_area.entries[index] = host_entry;
+        m_count++;
+        return false;
+    }
+
+    return true;
+}
+
+bool msr_switch_t::guest_value(msr::id_t id, msr::value_t& value) const {
+    const auto index = find(id);
+    if (index == msr_not_found) {
+        return false;
+    }
+
+    value = m_guest_area.entries[index].data;
+    return true;
+}
+
+bool msr_switch_t::set_guest_value(msr::id_t id, msr::value_t value) {
+    const auto index = find(id);
+    if (index == msr_not_found) {
+        return false;
+    }
+
+    m_guest_area.entries[index].data = value;
+    return true;
+}
+
+bool msr_switch_t::set_host_value(msr::id_t id, msr::value_t value) {
+    const auto index = find(id);
+    if (index == msr_not_found) {
+        return false;
+    }
+
+    m_host_area.entries[index].data = value;
+    return true;
+}
+
+instruction_result_t msr_switch_t::attach(physical_address_t guest_area_address, physical_address_t host_area_address) {
+    auto result = vmwrite(field_t::ctrl_vmexit_msr_store_address, guest_area_address);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+    result = vmwrite(field_t::ctrl_vmentry_msr_load_address, guest_area_address);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+    result = vmwrite(field_t::ctrl_vmexit_msr_load_address, host_area_address);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    m_attached = true;
+    return write_counts();
+}
+
+void msr_switch_t::detach() {
+    m_attached = false;
+}
+
+size_t msr_switch_t::find(msr::id_t id) const {
+    for (size_t i = 0; i < m_count; ++i) {
+        if (m_guest_area.entries[i].index == id) {
+            return i;
+        }
+    }
+
+    return msr_not_found;
+}
+
+instruction_result_t msr_switch_t::write_counts() const {
+    if (!m_attached) {
+        return instruction_result_t::success;
+    }
+
+    auto result = vmwrite(field_t::ctrl_vmexit_msr_store_count, m_count);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+    result = vmwrite(field_t::ctrl_vmexit_msr_load_count, m_count);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    return vmwrite(field_t::ctrl_vmentry_msr_load_count, m_count);
+}
+
+}
@@ -0,0 +1,134 @@
+
+#include "x86/vmx/msr_bitmap.h"
+
+
+namespace x86::vmx {
+
+enum class msr_access_t {
+    read,
+    write
+};
+
+static uint64_t* bitmap_for(msr_bitmap_t& bitmap, msr_access_t access, msr::id_t id) {
+    if (id <= msr_bitmap_low_last) {
+        return access == msr_access_t::read ? bitmap.read_low : bitmap.write_low;
+    }
+    if (id >= msr_bitmap_high_first && id <= msr_bitmap_high_last) {
+        return access == msr_access_t::read ? bitmap.read_high : bitmap.write_high;
+    }
+
+    return nullptr;
+}
+
+static bool update(msr_bitmap_t& bitmap, msr_access_t access, msr::id_t first, msr::id_t last, bool intercept) {
+    if (first > last) {
+        return false;
+    }
+
+    auto words = bitmap_for(bitmap, access, first);
+    if (words != bitmap_for(bitmap, access, last)) {
+        return false;
+    }
+    if (words == nullptr) {
+        // msrs outside the bitmap ranges can't be passed through
+        // and always exit, so intercepting them is trivially done.
+        return intercept;
+    }
+
+    const auto offset = first & (msr_bitmap_msrs_in_range - 1);
+    const auto count = static_cast<size_t>(last - first) + 1;
+    if (intercept) {
+        bitmap::set_range(words, offset, count);
+    } else {
+        bitmap::clear_range(words, offset, count);
+    }
+
+    return true;
+}
+
+bool msr_bitmap_t::is_in_bitmap(msr::id_t id) {
+    return id <= msr_bitmap_low_last ||
+           (id >= msr_bitmap_high_first && id <= msr_bitmap_high_last);
+}
+
+void msr_bitmap_t::intercept_all() {
+    bitmap::fill(read_low, words_in_range, true);
+    bitmap::fill(read_high, words_in_range, true);
+    bitmap::fill(write_low, words_in_range, true);
+    bitmap::fill(write_high, words_in_range, true);
+}
+
+void msr_bitmap_t::passthrough_all() {
+    bitmap::fill(read_low, words_in_range, false);
+    bitmap::fill(read_high, words_in_range, false);
+    bitmap::fill(write_low, words_in_range, false);
+    bitmap::fill(write_high, words_in_range, false);
+}
+
+bool msr_bitmap_t::intercept_read(msr::id_t id) {
+    return update(*this, msr_access_t::read, id, id, true);
+}
+
+bool msr_bitmap_t::intercept_write(msr::id_t id) {
+    return update(*this, msr_access_t::write, id, id, true);
+}
+
+bool msr_bitmap_t::intercept(msr::id_t id) {
+    return intercept_read(id) && intercept_write(id);
+}
+
+bool msr_bitmap_t::passthrough_read(msr::id_t id) {
+    return update(*this, msr_access_t::read, id, id, false);
+}
+
+bool msr_bitmap_t::passthrough_write(msr::id_t id) {
+    return update(*this, msr_access_t::write, id, id, false);
+}
+
+bool msr_bitmap_t::passthrough(msr::id_t id) {
+    return passthrough_read(id) && passthrough_write(id);
+}
+
+bool msr_bitmap_t::intercept_read(msr::id_t first, msr::id_t last) {
+    return update(*this, msr_access_t::read, first, last, true);
+}
+
+bool msr_bitmap_t::intercept_write(msr::id_t first, msr::id_t last) {
+    return update(*this, msr_access_t::write, first, last, true);
+}
+
+bool msr_bitmap_t::intercept(msr::id_t first, msr::id_t last) {
+    return intercept_read(first, last) && intercept_write(first, last);
+}
+
+bool msr_bitmap_t::passthrough_read(msr::id_t first, msr::id_t last) {
+    return update(*this, msr_access_t::read, first, last, false);
+}
+
+bool msr_bitmap_t::passthrough_write(msr::id_t first, msr::id_t last) {
+    return update(*this, msr_access_t::write, first, last, false);
+}
+
+bool msr_bitmap_t::passthrough(msr::id_t first, msr::id_t last) {
+    return passthrough_read(first, last) && passthrough_write(first, last);
+}
+
+bool msr_bitmap_t::is_read_intercepted(msr::id_t id) const {
+    auto words = bitmap_for(const_cast<msr_bitmap_t&>(*this), msr_access_t::read, id);
+    if (words == nullptr) {
+        return true;
+    }
+
+    return bitmap::test(words, id & (msr_bitmap_msrs_in_range - 1));
+}
+
+bool msr_bitmap_t::is_write_intercepted(msr::id_t id) const {
+    auto words = bitmap_for(const_cast<msr_bitmap_t&>(*this), msr_access_t::write, id);
+    if (words == nullptr) {
+        return true;
+    }
+
+    return bitmap::test(words, id & (msr_bitmap_msrs_in_range - 1));
+}
+
+}
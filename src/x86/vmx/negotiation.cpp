@@ -0,0 +1,198 @@
+
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/negotiation.h"
+
+
+namespace x86::vmx {
+
+struct feature_controls_t {
+    pin_based_exec_controls_t pin_based;
+    processor_based_exec_controls_t processor_based;
+    secondary_processor_based_exec_controls_t secondary_processor_based;
+    vmexit_controls_t vmexit;
+    vmentery_controls_t vmentry;
+    features_t dependencies;
+};
+
+static feature_controls_t controls_for(feature_t feature) {
+    feature_controls_t controls{};
+    auto& pin = controls.pin_based.bits;
+    auto& proc = controls.processor_based.bits;
+    auto& secondary = controls.secondary_processor_based.bits;
+    auto& exit = controls.vmexit.bits;
+    auto& dependencies = controls.dependencies;
+
+    switch (feature) {
+        case feature_t::tpr_shadow:
+            proc.use_tpr_shadow = true;
+            break;
+        case feature_t::ept:
+            secondary.enable_ept = true;
+            break;
+        case feature_t::vpid:
+            secondary.enable_vpid = true;
+            break;
+        case feature_t::unrestricted_guest:
+            // [SDM 3 26.2.1.1]
+            secondary.unrestricted_guest = true;
+            dependencies.set(feature_t::ept);
+            break;
+        case feature_t::pml:
+            secondary.enable_pml = true;
+            dependencies.set(feature_t::ept);
+            break;
+        case feature_t::tsc_offsetting:
+            proc.use_tsc_offsetting = true;
+            break;
+        case feature_t::tsc_scaling:
+            // [SDM 3 25.3] scaling only applies with offsetting
+            secondary.use_tsc_scaling = true;
+            dependencies.set(feature_t::tsc_offsetting);
+            break;
+        case feature_t::rdtscp:
+            secondary.enable_rdtscp = true;
+            break;
+        case feature_t::msr_bitmaps:
+            proc.use_msr_bitmaps = true;
+            break;
+        case feature_t::io_bitmaps:
+            proc.use_io_bitmaps = true;
+            break;
+        case feature_t::preemption_timer:
+            pin.activate_preemption_timer = true;
+            exit.save_preemption_timer_value = true;
+            break;
+        case feature_t::virtualize_x2apic:
+            secondary.virtualize_x2apic = true;
+            dependencies.set(feature_t::tpr_shadow);
+            break;
+        case feature_t::apic_register_virtualization:
+            secondary.apic_register_virtualization = true;
+            dependencies.set(feature_t::tpr_shadow);
+            break;
+        case feature_t::virtual_interrupt_delivery:
+            // [SDM 3 26.2.1.1]
+            secondary.virtual_interrupt_delivery = true;
+            pin.external_interrupt_exiting = true;
+            dependencies.set(feature_t::tpr_shadow);
+            break;
+        case feature_t::posted_interrupts:
+            // [SDM 3 26.2.1.1]
+            pin.process_posted_interrupts = true;
+            pin.external_interrupt_exiting = true;
+            exit.acknowledge_interrupt_on_exit = true;
+            dependencies.set(feature_t::virtual_interrupt_delivery);
+            break;
+        case feature_t::vmcs_shadowing:
+            secondary.vmcs_shadowing = true;
+            break;
+        case feature_t::invpcid:
+            secondary.enable_invpcid = true;
+            break;
+        case feature_t::xsaves:
+            secondary.enable_xsaves_xstors = true;
+            break;
+        case feature_t::pause_loop_exiting:
+            secondary.pause_loop_exiting = true;
+            break;
+        case feature_t::count:
+            break;
+    }
+
+    return controls;
+}
+
+template<typename _controls>
+static bool are_allowed(const _controls& controls) {
+    const auto allowed = get_controls_allowed<_controls>();
+    return (controls.raw & ~allowed.allowed1) == 0;
+}
+
+static bool is_supported(feature_t feature, const feature_controls_t& controls) {
+    if (!are_allowed(controls.pin_based) ||
+        !are_allowed(controls.processor_based) ||
+        !are_allowed(controls.vmexit) ||
+        !are_allowed(controls.vmentry)) {
+        return false;
+    }
+    if (controls.secondary_processor_based.raw != 0 &&
+        (!capabilities().are_secondary_controls_supported() || !are_allowed(controls.secondary_processor_based))) {
+        return false;
+    }
+
+    // features which need more than their control to be usable
+    const auto ept_vpid_cap = capabilities().ept_vpid_cap();
+    switch (feature) {
+        case feature_t::ept:
+            // we only support 4 level ept
+            return ept_vpid_cap.bits.page_walk_length_4;
+        case feature_t::vpid:
+            return ept_vpid_cap.bits.invvpid;
+        case feature_t::pml:
+            // [SDM 3 28.2.6] pml logs on dirty flag updates
+            return ept_vpid_cap.bits.ept_accessed_dirty;
+        default:
+            return true;
+    }
+}
+
+static features_t with_dependencies(features_t features) {
+    // dependencies come before the feature, so going backwards picks up chains
+    for (uint32_t i = static_cast<uint32_t>(feature_t::count); i > 0; --i) {
+        const auto feature = static_cast<feature_t>(i - 1);
+        if (features.has(feature)) {
+            features.raw |= controls_for(feature).dependencies.raw;
+        }
+    }
+
+    return features;
+}
+
+bool negotiate_controls(const feature_profile_t& profile, negotiated_controls_t& result) {
+    const auto required = with_dependencies(profile.required);
+    const auto wanted = with_dependencies(features_t{profile.required.raw | profile.preferred.raw});
+
+    result.enabled = {};
+    result.fallen_back = {};
+    result.missing = {};
+
+    for (uint32_t i = 0; i < static_cast<uint32_t>(feature_t::count); ++i) {
+        const auto feature = static_cast<feature_t>(i);
+        if (!wanted.has(feature)) {
+            continue;
+        }
+
+        const auto controls = controls_for(feature);
+        const auto dependencies_enabled = (controls.dependencies.raw & ~result.enabled.raw) == 0;
+        if (dependencies_enabled && is_supported(feature, controls)) {
+            result.pin_based.raw |= controls.pin_based.raw;
+            result.processor_based.raw |= controls.processor_based.raw;
+            result.secondary_processor_based.raw |= controls.secondary_processor_based.raw;
+            result.vmexit.raw |= controls.vmexit.raw;
+            result.vmentry.raw |= controls.vmentry.raw;
+            result.enabled.set(feature);
+        } else if (required.has(feature)) {
+            result.missing.set(feature);
+        } else {
+            result.fallen_back.set(feature);
+        }
+    }
+
+    if (result.secondary_processor_based.raw != 0) {
+        result.processor_based.bits.activate_secondary_controls = true;
+    }
+
+    result.pin_based = adjust_vm_controls(result.pin_based);
+    result.processor_based = adjust_vm_controls(result.processor_based);
+    result.vmexit = adjust_vm_controls(result.vmexit);
+    result.vmentry = adjust_vm_controls(result.vmentry);
+    if (result.processor_based.bits.activate_secondary_controls) {
+        result.secondary_processor_based = adjust_vm_controls(result.secondary_processor_based);
+    } else {
+        result.secondary_processor_based.raw = 0;
+    }
+
+    return result.missing.empty();
+}
+
+}
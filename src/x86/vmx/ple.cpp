@@ -0,0 +1,98 @@
+
+#include "x86/vmx/ple.h"
+
+
+namespace x86::vmx {
+
+void enable_pause_loop_exiting(processor_based_exec_controls_t& controls,
+                               secondary_processor_based_exec_controls_t& secondary) {
+    controls.bits.pause_exiting = false;
+    controls.bits.activate_secondary_controls = true;
+    secondary.bits.pause_loop_exiting = true;
+}
+
+ple_controller_t::ple_controller_t(const ple_config_t& config)
+    : m_config(config)
+    , m_window(config.min_window)
+    , m_period_start(0)
+    , m_exits_in_period(0)
+    , m_exit_rate(0)
+    , m_dirty(true) {
+    // the window and the elapsed time are divided by them
+    if (m_config.shrink_factor == 0) {
+        m_config.shrink_factor = 1;
+    }
+    if (m_config.sample_period == 0) {
+        m_config.sample_period = 1;
+    }
+}
+
+uint32_t ple_controller_t::window() const {
+    return m_window;
+}
+
+uint32_t ple_controller_t::exit_rate() const {
+    return m_exit_rate;
+}
+
+bool ple_controller_t::on_pause_exit(uint64_t tsc, bool can_yield) {
+    sample(tsc);
+    m_exits_in_period++;
+
+    if (can_yield) {
+        window(m_window / m_config.shrink_factor);
+        return true;
+    }
+
+    if (m_exits_in_period >= m_config.grow_threshold) {
+        window(static_cast<uint64_t>(m_window) * m_config.grow_factor);
+    }
+
+    return false;
+}
+
+instruction_result_t ple_controller_t::write_to_vmcs() {
+    if (!m_dirty) {
+        return instruction_result_t::success;
+    }
+
+    auto result = vmwrite(field_t::ctrl_ple_gap, m_config.gap);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+    result = vmwrite(field_t::ctrl_ple_window, m_window);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    m_dirty = false;
+    return instruction_result_t::success;
+}
+
+void ple_controller_t::sample(uint64_t tsc) {
+    if (tsc - m_period_start < m_config.sample_period) {
+        return;
+    }
+
+    // a period with no exits at all in between counts as 0
+    const auto elapsed_periods = (tsc - m_period_start) / m_config.sample_period;
+    m_exit_rate = elapsed_periods > 1 ? 0 : m_exits_in_period;
+    m_exits_in_period = 0;
+    m_period_start = tsc;
+}
+
+void ple_controller_t::window(uint64_t value) {
+    if (value < m_config.min_window) {
+        value = m_config.min_window;
+    }
+    if (value > m_config.max_window) {
+        value = m_config.max_window;
+    }
+
+    if (value != m_window) {
+        m_window = static_cast<uint32_t>(value);
+        m_dirty = true;
+    }
+}
+
+}
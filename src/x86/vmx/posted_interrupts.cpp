@@ -0,0 +1,119 @@
+
+#include "x86/atomic.h"
+#include "x86/apic.h"
+#include "x86/vmx/posted_interrupts.h"
+
+
+namespace x86::vmx {
+
+posted_interrupt_descriptor_t::control_t posted_interrupt_descriptor_t::read_control() const {
+    control_t value{};
+    value.raw = control;
+    return value;
+}
+
+void posted_interrupt_descriptor_t::notification(uint8_t vector, uint32_t apic_id, bool x2apic) {
+    // in xapic mode, the apic id is in bits 15:8 of ndst
+    const uint32_t destination = x2apic ? apic_id : ((apic_id & 0xff) << 8);
+
+    while (true) {
+        auto expected = read_control();
+        auto value = expected;
+        value.bits.nv = vector;
+        value.bits.ndst = destination;
+
+        if (x86::atomic::cmpswap64(&control, expected.raw, value.raw)) {
+            break;
+        }
+    }
+}
+
+void posted_interrupt_descriptor_t::suppress_notifications(bool suppress) {
+    control_t mask{};
+    mask.bits.sn = 1;
+
+    if (suppress) {
+        x86::atomic::or64(&control, mask.raw);
+    } else {
+        x86::atomic::and64(&control, ~mask.raw);
+    }
+}
+
+bool posted_interrupt_descriptor_t::post(uint8_t vector) {
+    x86::atomic::or64(&pir[vector / 64], bit(vector % 64));
+
+    while (true) {
+        auto expected = read_control();
+        if (expected.bits.on || expected.bits.sn) {
+            // someone else notifies, or the vcpu doesn't want notifications
+            return false;
+        }
+
+        auto value = expected;
+        value.bits.on = 1;
+        if (x86::atomic::cmpswap64(&control, expected.raw, value.raw)) {
+            return true;
+        }
+    }
+}
+
+void posted_interrupt_descriptor_t::post_and_notify(uint8_t vector, bool x2apic) {
+    if (!post(vector)) {
+        return;
+    }
+
+    const auto current = read_control();
+    const uint32_t destination = x2apic ? current.bits.ndst : ((current.bits.ndst >> 8) & 0xff);
+    x86::apic::send_fixed_ipi(destination, current.bits.nv);
+}
+
+bool posted_interrupt_descriptor_t::test_and_clear_on() {
+    while (true) {
+        auto expected = read_control();
+        if (!expected.bits.on) {
+            return false;
+        }
+
+        auto value = expected;
+        value.bits.on = 0;
+        if (x86::atomic::cmpswap64(&control, expected.raw, value.raw)) {
+            return true;
+        }
+    }
+}
+
+bool posted_interrupt_descriptor_t::is_pending() const {
+    return (pir[0] | pir[1] | pir[2] | pir[3]) != 0;
+}
+
+bool posted_interrupt_descriptor_t::harvest(uint64_t (&requests)[4]) {
+    bool any = false;
+    for (size_t i = 0; i < array_size(pir); ++i) {
+        // skip the locked swap for empty words
+        requests[i] = pir[i] != 0 ? x86::atomic::swap64(&pir[i], 0) : 0;
+        any |= requests[i] != 0;
+    }
+
+    return any;
+}
+
+void enable_posted_interrupts(pin_based_exec_controls_t& pin_based,
+                              secondary_processor_based_exec_controls_t& secondary,
+                              vmexit_controls_t& vmexit) {
+    // [SDM 3 26.2.1.1]
+    pin_based.bits.process_posted_interrupts = true;
+    pin_based.bits.external_interrupt_exiting = true;
+    secondary.bits.virtual_interrupt_delivery = true;
+    vmexit.bits.acknowledge_interrupt_on_exit = true;
+}
+
+instruction_result_t set_posted_interrupts(uint8_t notification_vector, physical_address_t descriptor_address) {
+    auto result = vmwrite(field_t::ctrl_posted_interrupt_notification_vector, notification_vector);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    return vmwrite(field_t::ctrl_posted_interrupt_descriptor_address, descriptor_address);
+}
+
+}
@@ -0,0 +1,191 @@
+
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/preemption_timer.h"
+
+
+namespace x86::vmx {
+
+size_t preemption_timer_rate() {
+    // [SDM 3 A.6]
+    const auto misc = capabilities().misc();
+    return misc.bits.preemption_timer_rate_to_tsc;
+}
+
+uint32_t tsc_to_preemption_timer(uint64_t tsc_ticks) {
+    const auto ticks = tsc_ticks >> preemption_timer_rate();
+    if (ticks > preemption_timer_max_value) {
+        return preemption_timer_max_value;
+    }
+
+    return static_cast<uint32_t>(ticks);
+}
+
+uint64_t preemption_timer_to_tsc(uint32_t timer_ticks) {
+    return static_cast<uint64_t>(timer_ticks) << preemption_timer_rate();
+}
+
+void enable_preemption_timer(pin_based_exec_controls_t& pin_based, vmexit_controls_t& vmexit) {
+    pin_based.bits.activate_preemption_timer = true;
+    vmexit.bits.save_preemption_timer_value = true;
+}
+
+timeslice_scheduler_t::timeslice_scheduler_t(uint64_t quantum_tsc_ticks)
+    : m_vcpus()
+    , m_current(no_vcpu)
+    , m_quantum(tsc_to_preemption_timer(quantum_tsc_ticks)) {
+    if (m_quantum == 0) {
+        // a 0 value exits right away on vmentry, never making progress
+        m_quantum = 1;
+    }
+}
+
+bool timeslice_scheduler_t::add(size_t& id) {
+    for (size_t i = 0; i < max_vcpus; ++i) {
+        auto& vcpu = m_vcpus[i];
+        if (vcpu.used) {
+            continue;
+        }
+
+        vcpu.used = true;
+        vcpu.runnable = true;
+        refill(vcpu);
+
+        if (m_current == no_vcpu) {
+            m_current = i;
+        }
+
+        id = i;
+        return true;
+    }
+
+    return false;
+}
+
+void timeslice_scheduler_t::remove(size_t id) {
+    if (id >= max_vcpus) {
+        return;
+    }
+
+    m_vcpus[id].used = false;
+    m_vcpus[id].runnable = false;
+
+    if (m_current == id) {
+        rotate();
+    }
+}
+
+void timeslice_scheduler_t::runnable(size_t id, bool runnable) {
+    if (id >= max_vcpus) {
+        return;
+    }
+
+    // an unused slot stays not runnable, and so doesn't become the current vcpu
+    m_vcpus[id].runnable = m_vcpus[id].used && runnable;
+    if (m_vcpus[id].runnable && m_current == no_vcpu) {
+        m_current = id;
+    }
+}
+
+bool timeslice_scheduler_t::is_runnable(size_t id) const {
+    return id < max_vcpus && m_vcpus[id].runnable;
+}
+
+size_t timeslice_scheduler_t::current() const {
+    return m_current;
+}
+
+uint32_t timeslice_scheduler_t::remaining(size_t id) const {
+    if (id >= max_vcpus) {
+        return 0;
+    }
+
+    return m_vcpus[id].remaining;
+}
+
+size_t timeslice_scheduler_t::rotate() {
+    const auto start = m_current == no_vcpu ? 0 : m_current + 1;
+    for (size_t i = 0; i < max_vcpus; ++i) {
+        const auto index = (start + i) % max_vcpus;
+        if (m_vcpus[index].runnable) {
+            m_current = index;
+            return m_current;
+        }
+    }
+
+    m_current = no_vcpu;
+    return m_current;
+}
+
+bool timeslice_scheduler_t::has_other_runnable() const {
+    for (size_t i = 0; i < max_vcpus; ++i) {
+        if (i != m_current && m_vcpus[i].runnable) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool timeslice_scheduler_t::yield() {
+    const auto previous = m_current;
+    return rotate() != previous;
+}
+
+instruction_result_t timeslice_scheduler_t::arm() {
+    auto& vcpu = m_vcpus[m_current];
+    if (vcpu.remaining == 0) {
+        refill(vcpu);
+    }
+
+    if (!vcpu.dirty) {
+        // saved by the cpu on the last vmexit, no need to write it again
+        return instruction_result_t::success;
+    }
+
+    const auto result = vmwrite(field_t::guest_vmx_preemption_timer_value, vcpu.remaining);
+    if (result == instruction_result_t::success) {
+        vcpu.dirty = false;
+    }
+
+    return result;
+}
+
+bool timeslice_scheduler_t::on_vmexit(exit_reason_t reason) {
+    if (m_current == no_vcpu) {
+        return false;
+    }
+
+    auto& vcpu = m_vcpus[m_current];
+
+    if (reason != exit_reason_t::vmx_preemption_timer_expired) {
+        uint64_t value;
+        if (vmread(field_t::guest_vmx_preemption_timer_value, value) == instruction_result_t::success) {
+            vcpu.remaining = static_cast<uint32_t>(value);
+        } else {
+            vcpu.dirty = true;
+        }
+
+        if (vcpu.remaining != 0) {
+            if (vcpu.runnable) {
+                return false;
+            }
+
+            // blocked, it keeps the rest of its slice for when it is runnable again
+            const auto previous = m_current;
+            return rotate() != previous;
+        }
+    }
+
+    // slice used up, next time this vcpu runs it gets a full one
+    refill(vcpu);
+
+    const auto previous = m_current;
+    return rotate() != previous;
+}
+
+void timeslice_scheduler_t::refill(vcpu_t& vcpu) {
+    vcpu.remaining = m_quantum;
+    vcpu.dirty = true;
+}
+
+}
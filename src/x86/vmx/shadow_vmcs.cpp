@@ -0,0 +1,131 @@
+
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/shadow_vmcs.h"
+
+
+namespace x86::vmx {
+
+static constexpr uint64_t no_link_pointer = static_cast<uint64_t>(-1);
+
+void vmcs_field_bitmap_t::intercept_all() {
+    bitmap::fill(words, word_count, true);
+}
+
+void vmcs_field_bitmap_t::passthrough_all() {
+    bitmap::fill(words, word_count, false);
+}
+
+void vmcs_field_bitmap_t::intercept(field_t field) {
+    bitmap::set(words, static_cast<uint32_t>(field) & index_mask);
+}
+
+void vmcs_field_bitmap_t::passthrough(field_t field) {
+    bitmap::clear(words, static_cast<uint32_t>(field) & index_mask);
+}
+
+void vmcs_field_bitmap_t::intercept(const field_t* fields, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        intercept(fields[i]);
+    }
+}
+
+void vmcs_field_bitmap_t::passthrough(const field_t* fields, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        passthrough(fields[i]);
+    }
+}
+
+bool vmcs_field_bitmap_t::is_intercepted(field_t field) const {
+    return bitmap::test(words, static_cast<uint32_t>(field) & index_mask);
+}
+
+bool is_vmcs_shadowing_supported() {
+    if (!capabilities().are_secondary_controls_supported()) {
+        return false;
+    }
+
+    secondary_processor_based_exec_controls_t allowed{};
+    allowed.raw = get_controls_allowed<secondary_processor_based_exec_controls_t>().allowed1;
+    return allowed.bits.vmcs_shadowing;
+}
+
+void enable_vmcs_shadowing(processor_based_exec_controls_t& controls,
+                           secondary_processor_based_exec_controls_t& secondary) {
+    controls.bits.activate_secondary_controls = true;
+    secondary.bits.vmcs_shadowing = true;
+}
+
+instruction_result_t set_shadow_vmcs(physical_address_t shadow_vmcs,
+                                     physical_address_t vmread_bitmap,
+                                     physical_address_t vmwrite_bitmap) {
+    auto result = vmwrite(field_t::ctrl_vmread_bitmap_address, vmread_bitmap);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+    result = vmwrite(field_t::ctrl_vmwrite_bitmap_address, vmwrite_bitmap);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    return vmwrite(field_t::guest_link_pointer, shadow_vmcs);
+}
+
+instruction_result_t clear_shadow_vmcs() {
+    return vmwrite(field_t::guest_link_pointer, no_link_pointer);
+}
+
+template<typename _copy>
+static instruction_result_t with_shadow_current(physical_address_t shadow_vmcs, _copy copy) {
+    physical_address_t previous = 0;
+    auto result = vmptrst(previous);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    result = vmptrld(shadow_vmcs);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    const auto copy_result = copy();
+
+    // vmptrst gives all 1s when no vmcs was current
+    if (previous != no_link_pointer) {
+        result = vmptrld(previous);
+        if (result != instruction_result_t::success) {
+            return result;
+        }
+    }
+
+    return copy_result;
+}
+
+instruction_result_t read_shadow_fields(physical_address_t shadow_vmcs,
+                                        const field_t* fields, uint64_t* values, size_t count) {
+    return with_shadow_current(shadow_vmcs, [fields, values, count]() {
+        for (size_t i = 0; i < count; ++i) {
+            const auto result = vmread(fields[i], values[i]);
+            if (result != instruction_result_t::success) {
+                return result;
+            }
+        }
+
+        return instruction_result_t::success;
+    });
+}
+
+instruction_result_t write_shadow_fields(physical_address_t shadow_vmcs,
+                                         const field_t* fields, const uint64_t* values, size_t count) {
+    return with_shadow_current(shadow_vmcs, [fields, values, count]() {
+        for (size_t i = 0; i < count; ++i) {
+            const auto result = vmwrite(fields[i], values[i]);
+            if (result != instruction_result_t::success) {
+                return result;
+            }
+        }
+
+        return instruction_result_t::success;
+    });
+}
+
+}
@@ -0,0 +1,166 @@
+
+#include "x86/tsc.h"
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/tsc.h"
+
+
+namespace x86::vmx {
+
+// the secondary controls are read too, the vmcs may use others. use_tsc_scaling only
+// takes effect with activate_secondary_controls, which is left set when scaling stops.
+static instruction_result_t write_scaling_control(bool scaling) {
+    uint64_t value;
+    auto result = vmread(field_t::ctrl_secondary_processor_based_vm_execution_controls, value);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    secondary_processor_based_exec_controls_t secondary_controls{};
+    secondary_controls.raw = static_cast<uint32_t>(value);
+    secondary_controls.bits.use_tsc_scaling = scaling;
+    result = vmwrite(field_t::ctrl_secondary_processor_based_vm_execution_controls, secondary_controls.raw);
+    if (result != instruction_result_t::success || !scaling) {
+        return result;
+    }
+
+    result = vmread(field_t::ctrl_processor_based_vm_execution_controls, value);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    processor_based_exec_controls_t controls{};
+    controls.raw = static_cast<uint32_t>(value);
+    if (controls.bits.activate_secondary_controls) {
+        return instruction_result_t::success;
+    }
+
+    controls.bits.activate_secondary_controls = true;
+    return vmwrite(field_t::ctrl_processor_based_vm_execution_controls, controls.raw);
+}
+
+bool is_tsc_scaling_supported() {
+    if (!capabilities().are_secondary_controls_supported()) {
+        return false;
+    }
+
+    secondary_processor_based_exec_controls_t allowed{};
+    allowed.raw = get_controls_allowed<secondary_processor_based_exec_controls_t>().allowed1;
+    return allowed.bits.use_tsc_scaling;
+}
+
+tsc_virtualization_t::tsc_virtualization_t()
+    : m_multiplier(tsc_multiplier_identity)
+    , m_offset(0)
+    , m_last_guest_tsc(0)
+    , m_dirty(true)
+    , m_scaling_in_vmcs(false)
+{}
+
+uint64_t tsc_virtualization_t::multiplier() const {
+    return m_multiplier;
+}
+
+uint64_t tsc_virtualization_t::offset() const {
+    return m_offset;
+}
+
+bool tsc_virtualization_t::is_scaling() const {
+    return m_multiplier != tsc_multiplier_identity;
+}
+
+bool tsc_virtualization_t::set_frequency(uint64_t guest_frequency, uint64_t host_frequency) {
+    if (guest_frequency == 0 || host_frequency == 0) {
+        return false;
+    }
+    // the multiplier has 16 integer bits
+    if ((guest_frequency >> (64 - tsc_multiplier_fraction_bits)) >= host_frequency) {
+        return false;
+    }
+
+    const auto host_tsc = x86::tsc::read();
+    const auto current = guest_tsc(host_tsc);
+
+    m_multiplier = mul_div(guest_frequency, tsc_multiplier_identity, host_frequency);
+    set_guest_tsc(current, host_tsc);
+
+    return true;
+}
+
+void tsc_virtualization_t::set_guest_tsc(uint64_t value, uint64_t host_tsc) {
+    // arithmetic is mod 2^64, so a "negative" offset works as well
+    m_offset = value - mul_shift(host_tsc, m_multiplier, tsc_multiplier_fraction_bits);
+    m_dirty = true;
+}
+
+uint64_t tsc_virtualization_t::guest_tsc(uint64_t host_tsc) const {
+    return mul_shift(host_tsc, m_multiplier, tsc_multiplier_fraction_bits) + m_offset;
+}
+
+void tsc_virtualization_t::on_vcpu_put(uint64_t host_tsc) {
+    m_last_guest_tsc = guest_tsc(host_tsc);
+}
+
+void tsc_virtualization_t::on_vcpu_load(uint64_t host_tsc) {
+    // the new cpu's tsc may be behind the old one's, don't let
+    // the guest see time going backwards.
+    if (guest_tsc(host_tsc) < m_last_guest_tsc) {
+        set_guest_tsc(m_last_guest_tsc, host_tsc);
+    }
+}
+
+void tsc_virtualization_t::configure_controls(processor_based_exec_controls_t& controls,
+                                              secondary_processor_based_exec_controls_t& secondary_controls,
+                                              bool enable_rdtscp) const {
+    controls.bits.use_tsc_offsetting = true;
+    controls.bits.rdtsc_exiting = false;
+
+    if (enable_rdtscp) {
+        secondary_controls.bits.enable_rdtscp = true;
+    }
+    secondary_controls.bits.use_tsc_scaling = is_scaling();
+    if (secondary_controls.bits.enable_rdtscp || secondary_controls.bits.use_tsc_scaling) {
+        controls.bits.activate_secondary_controls = true;
+    }
+}
+
+instruction_result_t tsc_virtualization_t::write_to_vmcs() {
+    if (!m_dirty) {
+        return instruction_result_t::success;
+    }
+
+    auto result = vmwrite(field_t::ctrl_tsc_offset, m_offset);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    // the field and the control only exist if scaling is supported, it was if the
+    // vmcs is scaling
+    if (is_scaling() && !m_scaling_in_vmcs && !is_tsc_scaling_supported()) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+    if (is_scaling() || m_scaling_in_vmcs) {
+        result = vmwrite(field_t::ctrl_tsc_multiplier, m_multiplier);
+        if (result != instruction_result_t::success) {
+            return result;
+        }
+    }
+
+    if (is_scaling() != m_scaling_in_vmcs) {
+        result = write_scaling_control(is_scaling());
+        if (result != instruction_result_t::success) {
+            return result;
+        }
+        m_scaling_in_vmcs = is_scaling();
+    }
+
+    m_dirty = false;
+    return instruction_result_t::success;
+}
+
+bool add_guest_tsc_aux(msr_switch_t& msr_switch, uint32_t guest_aux) {
+    x86::msr::ia32_tsc_aux_t aux;
+    aux.bits.aux = guest_aux;
+    return msr_switch.add(aux);
+}
+
+}
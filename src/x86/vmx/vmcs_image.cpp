@@ -0,0 +1,401 @@
+
+#include "x86/bitmap.h"
+#include "x86/vmx/capabilities.h"
+#include "x86/vmx/vmcs_image.h"
+
+
+namespace x86::vmx {
+
+// ordered by encoding, the order of the values in the image. new fields may only be
+// added with a new image version.
+static constexpr field_t g_fields[] = {
+    // 16 bit
+    field_t::ctrl_virtual_processor_identifier,
+    field_t::ctrl_posted_interrupt_notification_vector,
+    field_t::ctrl_eptp_index,
+    field_t::guest_es_selector,
+    field_t::guest_cs_selector,
+    field_t::guest_ss_selector,
+    field_t::guest_ds_selector,
+    field_t::guest_fs_selector,
+    field_t::guest_gs_selector,
+    field_t::guest_ldtr_selector,
+    field_t::guest_tr_selector,
+    field_t::guest_interrupt_status,
+    field_t::guest_pml_index,
+    field_t::host_es_selector,
+    field_t::host_cs_selector,
+    field_t::host_ss_selector,
+    field_t::host_ds_selector,
+    field_t::host_fs_selector,
+    field_t::host_gs_selector,
+    field_t::host_tr_selector,
+
+    // 64 bit
+    field_t::ctrl_io_bitmap_a_address,
+    field_t::ctrl_io_bitmap_b_address,
+    field_t::ctrl_msr_bitmap_address,
+    field_t::ctrl_vmexit_msr_store_address,
+    field_t::ctrl_vmexit_msr_load_address,
+    field_t::ctrl_vmentry_msr_load_address,
+    field_t::ctrl_executive_pointer,
+    field_t::ctrl_pml_address,
+    field_t::ctrl_tsc_offset,
+    field_t::ctrl_virtual_apic_address,
+    field_t::ctrl_apic_access_address,
+    field_t::ctrl_posted_interrupt_descriptor_address,
+    field_t::ctrl_vmfunc_controls,
+    field_t::ctrl_ept_pointer,
+    field_t::ctrl_eoi_exit_bitmap_0,
+    field_t::ctrl_eoi_exit_bitmap_1,
+    field_t::ctrl_eoi_exit_bitmap_2,
+    field_t::ctrl_eoi_exit_bitmap_3,
+    field_t::ctrl_ept_pointer_list_address,
+    field_t::ctrl_vmread_bitmap_address,
+    field_t::ctrl_vmwrite_bitmap_address,
+    field_t::ctrl_virtualization_exception_information_address,
+    field_t::ctrl_xss_exiting_bitmap,
+    field_t::ctrl_encls_exiting_bitmap,
+    field_t::ctrl_tsc_multiplier,
+    field_t::guest_physical_address,
+    field_t::guest_link_pointer,
+    field_t::guest_debugctl,
+    field_t::guest_pat,
+    field_t::guest_efer,
+    field_t::guest_perf_global_ctrl,
+    field_t::guest_pdpte0,
+    field_t::guest_pdpte1,
+    field_t::guest_pdpte2,
+    field_t::guest_pdpte3,
+    field_t::host_pat,
+    field_t::host_efer,
+    field_t::host_perf_global_ctrl,
+
+    // 32 bit
+    field_t::ctrl_pin_based_vm_execution_controls,
+    field_t::ctrl_processor_based_vm_execution_controls,
+    field_t::ctrl_exception_bitmap,
+    field_t::ctrl_pagefault_error_code_mask,
+    field_t::ctrl_pagefault_error_code_match,
+    field_t::ctrl_cr3_target_count,
+    field_t::ctrl_vmexit_controls,
+    field_t::ctrl_vmexit_msr_store_count,
+    field_t::ctrl_vmexit_msr_load_count,
+    field_t::ctrl_vmentry_controls,
+    field_t::ctrl_vmentry_msr_load_count,
+    field_t::ctrl_vmentry_interruption_information_field,
+    field_t::ctrl_vmentry_exception_error_code,
+    field_t::ctrl_vmentry_instruction_length,
+    field_t::ctrl_tpr_threshold,
+    field_t::ctrl_secondary_processor_based_vm_execution_controls,
+    field_t::ctrl_ple_gap,
+    field_t::ctrl_ple_window,
+    field_t::vm_instruction_error,
+    field_t::exit_reason,
+    field_t::vmexit_interruption_information,
+    field_t::vmexit_interruption_error_code,
+    field_t::idt_vectoring_information,
+    field_t::idt_vectoring_error_code,
+    field_t::vmexit_instruction_length,
+    field_t::vmexit_instruction_info,
+    field_t::guest_es_limit,
+    field_t::guest_cs_limit,
+    field_t::guest_ss_limit,
+    field_t::guest_ds_limit,
+    field_t::guest_fs_limit,
+    field_t::guest_gs_limit,
+    field_t::guest_ldtr_limit,
+    field_t::guest_tr_limit,
+    field_t::guest_gdtr_limit,
+    field_t::guest_idtr_limit,
+    field_t::guest_es_access_rights,
+    field_t::guest_cs_access_rights,
+    field_t::guest_ss_access_rights,
+    field_t::guest_ds_access_rights,
+    field_t::guest_fs_access_rights,
+    field_t::guest_gs_access_rights,
+    field_t::guest_ldtr_access_rights,
+    field_t::guest_tr_access_rights,
+    field_t::guest_interruptibility_state,
+    field_t::guest_activity_state,
+    field_t::guest_smbase,
+    field_t::guest_sysenter_cs,
+    field_t::guest_vmx_preemption_timer_value,
+    field_t::sysenter_cs,
+
+    // natural width
+    field_t::ctrl_cr0_guest_host_mask,
+    field_t::ctrl_cr4_guest_host_mask,
+    field_t::ctrl_cr0_read_shadow,
+    field_t::ctrl_cr4_read_shadow,
+    field_t::ctrl_cr3_target_value_0,
+    field_t::ctrl_cr3_target_value_1,
+    field_t::ctrl_cr3_target_value_2,
+    field_t::ctrl_cr3_target_value_3,
+    field_t::exit_qualification,
+    field_t::io_rcx,
+    field_t::io_rsx,
+    field_t::io_rdi,
+    field_t::io_rip,
+    field_t::exit_guest_linear_address,
+    field_t::guest_cr0,
+    field_t::guest_cr3,
+    field_t::guest_cr4,
+    field_t::guest_es_base,
+    field_t::guest_cs_base,
+    field_t::guest_ss_base,
+    field_t::guest_ds_base,
+    field_t::guest_fs_base,
+    field_t::guest_gs_base,
+    field_t::guest_ldtr_base,
+    field_t::guest_tr_base,
+    field_t::guest_gdtr_base,
+    field_t::guest_idtr_base,
+    field_t::guest_dr7,
+    field_t::guest_rsp,
+    field_t::guest_rip,
+    field_t::guest_rflags,
+    field_t::guest_pending_debug_exceptions,
+    field_t::guest_sysenter_esp,
+    field_t::guest_sysenter_eip,
+    field_t::host_cr0,
+    field_t::host_cr3,
+    field_t::host_cr4,
+    field_t::host_fs_base,
+    field_t::host_gs_base,
+    field_t::host_tr_base,
+    field_t::host_gdtr_base,
+    field_t::host_idtr_base,
+    field_t::host_sysenter_esp,
+    field_t::host_sysenter_eip,
+    field_t::host_rsp,
+    field_t::host_rip,
+};
+static_assert(sizeof(g_fields) / sizeof(g_fields[0]) == vmcs_image_field_count, "vmcs_image_field_count");
+
+// [SDM 3 24.11.2 "Table 24-21"]
+static constexpr size_t field_width(field_t field) {
+    switch ((static_cast<uint32_t>(field) >> 13) & 0x3) {
+        case 0: return sizeof(uint16_t);
+        case 1: return sizeof(uint64_t);
+        case 2: return sizeof(uint32_t);
+        default: return sizeof(uintn_t);
+    }
+}
+
+static constexpr bool is_read_only(field_t field) {
+    return ((static_cast<uint32_t>(field) >> 10) & 0x3) == 1;
+}
+
+static constexpr size_t total_width() {
+    size_t size = 0;
+    for (auto field : g_fields) {
+        size += field_width(field);
+    }
+    return size;
+}
+static_assert(total_width() == vmcs_image_data_size, "vmcs_image_data_size");
+
+static constexpr size_t header_size = sizeof(vmcs_image_t) - vmcs_image_data_size;
+
+static size_t index_of(field_t field) {
+    for (size_t i = 0; i < vmcs_image_field_count; ++i) {
+        if (g_fields[i] == field) {
+            return i;
+        }
+    }
+
+    return vmcs_image_field_count;
+}
+
+static bool is_present(const vmcs_image_t& image, size_t index) {
+    return bitmap::test(image.present, index);
+}
+
+static uint64_t load_value(const uint8_t* data, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; ++i) {
+        value |= static_cast<uint64_t>(data[i]) << (i * 8);
+    }
+    return value;
+}
+
+static void store_value(uint8_t* data, size_t width, uint64_t value) {
+    for (size_t i = 0; i < width; ++i) {
+        data[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+}
+
+// walks the values of an image in list order
+class value_reader_t {
+public:
+    explicit value_reader_t(const vmcs_image_t* image)
+        : m_image(image)
+        , m_offset(0)
+    {}
+
+    // must be called for each index in order. returns false if the field isn't present.
+    bool next(size_t index, uint64_t& value) {
+        if (m_image == nullptr || !is_present(*m_image, index)) {
+            return false;
+        }
+
+        const auto width = field_width(g_fields[index]);
+        value = load_value(m_image->data + m_offset, width);
+        m_offset += width;
+        return true;
+    }
+
+private:
+    const vmcs_image_t* m_image;
+    size_t m_offset;
+};
+
+static void begin(vmcs_image_t& image, vmcs_image_kind_t kind) {
+    image.magic = vmcs_image_t::magic_value;
+    image.version = vmcs_image_t::current_version;
+    image.kind = kind;
+    image.revision = capabilities().basic().bits.vmcs_revision;
+    image.data_size = 0;
+    bitmap::fill(image.present, vmcs_image_t::present_words, false);
+}
+
+static void append(vmcs_image_t& image, size_t index, uint64_t value) {
+    const auto width = field_width(g_fields[index]);
+    store_value(image.data + image.data_size, width, value);
+    image.data_size += width;
+    bitmap::set(image.present, index);
+}
+
+bool vmcs_image_t::is_valid() const {
+    return magic == magic_value &&
+           version == current_version &&
+           (kind == vmcs_image_kind_t::full || kind == vmcs_image_kind_t::delta) &&
+           data_size <= vmcs_image_data_size &&
+           revision == capabilities().basic().bits.vmcs_revision;
+}
+
+size_t vmcs_image_t::size() const {
+    return header_size + data_size;
+}
+
+bool vmcs_image_t::has(field_t field) const {
+    const auto index = index_of(field);
+    return index < vmcs_image_field_count && is_present(*this, index);
+}
+
+bool vmcs_image_t::get(field_t field, uint64_t& value) const {
+    const auto index = index_of(field);
+    if (index >= vmcs_image_field_count || !is_present(*this, index)) {
+        return false;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < index; ++i) {
+        if (is_present(*this, i)) {
+            offset += field_width(g_fields[i]);
+        }
+    }
+
+    value = load_value(data + offset, field_width(field));
+    return true;
+}
+
+static instruction_result_t save(vmcs_image_t& image, const vmcs_image_t* base) {
+    begin(image, base != nullptr ? vmcs_image_kind_t::delta : vmcs_image_kind_t::full);
+
+    value_reader_t base_values(base);
+    for (size_t i = 0; i < vmcs_image_field_count; ++i) {
+        uint64_t base_value = 0;
+        const auto in_base = base_values.next(i, base_value);
+
+        uint64_t value = 0;
+        const auto result = vmread(g_fields[i], value);
+        if (result == instruction_result_t::vm_fail_valid) {
+            // not supported by this cpu
+            continue;
+        }
+        if (result != instruction_result_t::success) {
+            return result;
+        }
+
+        if (in_base && base_value == value) {
+            continue;
+        }
+
+        append(image, i, value);
+    }
+
+    return instruction_result_t::success;
+}
+
+instruction_result_t save_vmcs(vmcs_image_t& image) {
+    return save(image, nullptr);
+}
+
+instruction_result_t save_vmcs_delta(vmcs_image_t& image, const vmcs_image_t& base) {
+    return save(image, &base);
+}
+
+instruction_result_t restore_vmcs(const vmcs_image_t& image, const vmcs_image_t* current) {
+    if (!image.is_valid() || (current != nullptr && !current->is_valid())) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    value_reader_t values(&image);
+    value_reader_t current_values(current);
+    for (size_t i = 0; i < vmcs_image_field_count; ++i) {
+        uint64_t current_value = 0;
+        const auto in_current = current_values.next(i, current_value);
+
+        uint64_t value = 0;
+        if (!values.next(i, value)) {
+            continue;
+        }
+        if (is_read_only(g_fields[i])) {
+            continue;
+        }
+        if (in_current && current_value == value) {
+            continue;
+        }
+
+        const auto result = vmwrite(g_fields[i], value);
+        if (result != instruction_result_t::success) {
+            return result;
+        }
+    }
+
+    return instruction_result_t::success;
+}
+
+bool apply_delta(vmcs_image_t& base, const vmcs_image_t& delta) {
+    if (base.kind != vmcs_image_kind_t::full || delta.kind != vmcs_image_kind_t::delta ||
+        !base.is_valid() || !delta.is_valid()) {
+        return false;
+    }
+
+    // values may change position, so the merged image is built aside
+    vmcs_image_t merged;
+    begin(merged, vmcs_image_kind_t::full);
+    merged.revision = base.revision;
+
+    value_reader_t base_values(&base);
+    value_reader_t delta_values(&delta);
+    for (size_t i = 0; i < vmcs_image_field_count; ++i) {
+        uint64_t base_value = 0;
+        uint64_t delta_value = 0;
+        const auto in_base = base_values.next(i, base_value);
+        const auto in_delta = delta_values.next(i, delta_value);
+
+        if (in_delta) {
+            append(merged, i, delta_value);
+        } else if (in_base) {
+            append(merged, i, base_value);
+        }
+    }
+
+    base = merged;
+    return true;
+}
+
+}
@@ -0,0 +1,100 @@
+
+#include "x86/atomic.h"
+#include "x86/vmx/vmx.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/vmcs_tracker.h"
+
+
+namespace x86::vmx {
+
+vmcs_state_t::vmcs_state_t(physical_address_t address)
+    : address(address)
+    , owner(no_cpu)
+    , launched(false)
+{}
+
+vmcs_tracker_t::vmcs_tracker_t(uint32_t cpu)
+    : m_cpu(cpu)
+    , m_current(nullptr)
+{}
+
+uint32_t vmcs_tracker_t::cpu() const {
+    return m_cpu;
+}
+
+vmcs_state_t* vmcs_tracker_t::current() const {
+    return m_current;
+}
+
+instruction_result_t vmcs_tracker_t::load(vmcs_state_t& vmcs) {
+    if (m_current == &vmcs) {
+        return instruction_result_t::success;
+    }
+    // only this cpu moves the owner away from it, so it is stable once it is this cpu
+    const auto claimed = atomic::cmpswap32(&vmcs.owner, no_cpu, m_cpu);
+    if (!claimed && vmcs.owner != m_cpu) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    const auto result = vmptrld(vmcs.address);
+    if (result != instruction_result_t::success) {
+        if (claimed) {
+            atomic::swap32(&vmcs.owner, no_cpu);
+        }
+        return result;
+    }
+
+    // the previous vmcs stays active on this cpu (not current), so it can be
+    // loaded again later without a vmclear
+    m_current = &vmcs;
+    return instruction_result_t::success;
+}
+
+instruction_result_t vmcs_tracker_t::release(vmcs_state_t& vmcs) {
+    if (vmcs.owner == no_cpu) {
+        return instruction_result_t::success;
+    }
+    if (vmcs.owner != m_cpu) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    // [SDM 3 24.11.3] vmclear writes the cached data to memory and clears the launch state
+    const auto result = vmclear(vmcs.address);
+    if (result != instruction_result_t::success) {
+        return result;
+    }
+
+    vmcs.launched = false;
+    if (m_current == &vmcs) {
+        m_current = nullptr;
+    }
+    // last, another cpu may load it right away
+    atomic::swap32(&vmcs.owner, no_cpu);
+
+    return instruction_result_t::success;
+}
+
+instruction_result_t vmcs_tracker_t::release_current() {
+    if (m_current == nullptr) {
+        return instruction_result_t::success;
+    }
+
+    return release(*m_current);
+}
+
+instruction_result_t vmcs_tracker_t::enter() {
+    if (m_current == nullptr) {
+        return instruction_result_t::vm_fail_invalid;
+    }
+
+    // [SDM 3 26.1]
+    return m_current->launched ? vmresume() : vmlaunch();
+}
+
+void vmcs_tracker_t::on_vmexit(const full_exit_reason_t& reason) {
+    if (m_current != nullptr && !reason.bits.vmentry_failure) {
+        m_current->launched = true;
+    }
+}
+
+}
@@ -1,21 +1,21 @@
 
 #include "x86/cr.h"
-#include "x86/cpuid.h"
+#include "x86/cpu_features.h"
 #include "x86/msr.h"
 #include "x86/vmx/vmx.h"
+#include "x86/vmx/capabilities.h"
 
 
 namespace x86::vmx {
 
 bool is_supported() {
     // CPUID.1:ECX.VMX[bit 5] = 1 [SDM 3 23.6 P1050]
-    auto cpu_features = x86::cpuid<x86::cpuid_eax01_t>();
-    return cpu_features.ecx.bits.vmx;
+    return x86::has_feature<x86::features::vmx>();
 }
 
 // [SDM 3 A.7 P1960]
 uintn_t get_cr0_fixed0_bits(const bool for_unrestricted_guest) {
-    auto fixed0 = x86::read<x86::msr::ia32_vmx_cr0_fixed0_t>().raw;
+    auto fixed0 = capabilities().get<x86::msr::ia32_vmx_cr0_fixed0_t>().raw;
 
     if (for_unrestricted_guest) {
         // when in unrestricted guest mode, we don't need to account
@@ -30,16 +30,16 @@ uintn_t get_cr0_fixed0_bits(const bool for_unrestricted_guest) {
 }
 
 uintn_t get_cr0_fixed1_bits(const bool for_unrestricted_guest) {
-    return x86::read<x86::msr::ia32_vmx_cr0_fixed1_t>().raw;
+    return capabilities().get<x86::msr::ia32_vmx_cr0_fixed1_t>().raw;
 }
 
 // [SDM 3 A.8 P1960]
 uintn_t get_cr4_fixed0_bits() {
-    return x86::read<x86::msr::ia32_vmx_cr4_fixed0_t>().raw;
+    return capabilities().get<x86::msr::ia32_vmx_cr4_fixed0_t>().raw;
 }
 
 uintn_t get_cr4_fixed1_bits() {
-    return x86::read<x86::msr::ia32_vmx_cr4_fixed1_t>().raw;
+    return capabilities().get<x86::msr::ia32_vmx_cr4_fixed1_t>().raw;
 }
 
 void adjust_cr0_fixed_bits(x86::cr0_t& cr, const bool for_unrestricted_guest) {
@@ -91,14 +91,14 @@ bool prepare_for_vmxon(const bool for_unrestricted_guest) {
     return true;
 }
 
-bool initialize_vmstruct(vmstruct_t& vm_struct) {
-    auto vmx_basic = x86::read<x86::msr::ia32_vmx_basic_t>();
+bool initialize_vmstruct(vmstruct_t& vm_struct, const bool shadow) {
+    auto vmx_basic = capabilities().basic();
     if (sizeof(vm_struct) > vmx_basic.bits.vm_struct_size) {
         return false;
     }
 
     vm_struct.revision = vmx_basic.bits.vmcs_revision;
-    vm_struct.shadow_indicator = false;
+    vm_struct.shadow_indicator = shadow;
 
     return true;
 }
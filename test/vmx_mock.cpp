@@ -0,0 +1,104 @@
+#include "x86/tsc.h"
+#include "x86/vmx/vmx.h"
+#include "x86/vmx/vmcs.h"
+#include "x86/vmx/mock.h"
+
+// the library types clash with the libc headers
+extern "C" int printf(const char* format, ...);
+
+using namespace x86::vmx;
+
+// runs the vmcs instructions through the software model (X86_VMX_MOCK), checks their
+// results and reports the cost of vmread/vmwrite in the model.
+
+static constexpr size_t bench_iterations = 1000000;
+
+alignas(x86::paging::page_size_4k) static vmstruct_t g_vmxon_region{};
+alignas(x86::paging::page_size_4k) static vmstruct_t g_vmcs{};
+
+static int g_failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAIL: %s\n", what);
+        g_failures++;
+    }
+}
+
+static void test_instructions() {
+    const auto vmxon_address = reinterpret_cast<physical_address_t>(&g_vmxon_region);
+    const auto vmcs_address = reinterpret_cast<physical_address_t>(&g_vmcs);
+    g_vmxon_region.revision = mock::vmcs_revision;
+    g_vmcs.revision = mock::vmcs_revision;
+
+    check(vmptrld(vmcs_address) == instruction_result_t::vm_fail_invalid, "vmptrld outside vmx operation");
+    check(vmxon(vmxon_address) == instruction_result_t::success, "vmxon");
+    check(vmclear(vmcs_address) == instruction_result_t::success, "vmclear");
+    check(vmptrld(vmcs_address) == instruction_result_t::success, "vmptrld");
+
+    physical_address_t current = 0;
+    check(vmptrst(current) == instruction_result_t::success && current == vmcs_address, "vmptrst");
+
+    uint64_t value = 0;
+    check(vmwrite(field_t::guest_rip, 0x1000) == instruction_result_t::success, "vmwrite");
+    check(vmread(field_t::guest_rip, value) == instruction_result_t::success && value == 0x1000, "vmread");
+
+    // bit 12 of an encoding is reserved [SDM 3 24.11.2]
+    const auto invalid_field = static_cast<field_t>(0x1000);
+    check(vmwrite(invalid_field, 1) == instruction_result_t::vm_fail_valid, "vmwrite of an unsupported field");
+    check(vm_instruction_error() == instruction_error_t::vmreadwrite_unsupported_component, "vmwrite of an unsupported field error");
+
+    check(vmresume() == instruction_result_t::vm_fail_valid, "vmresume before vmlaunch");
+    check(vmlaunch() == instruction_result_t::success, "vmlaunch");
+    check(vmlaunch() == instruction_result_t::vm_fail_valid, "vmlaunch of a launched vmcs");
+    check(vm_instruction_error() == instruction_error_t::vmlaunch_non_clear_vmcs, "vmlaunch of a launched vmcs error");
+    check(vmresume() == instruction_result_t::success, "vmresume");
+
+    check(vmclear(vmcs_address) == instruction_result_t::success, "vmclear of the current vmcs");
+    check(vmread(field_t::guest_rip, value) == instruction_result_t::vm_fail_invalid, "vmread without a current vmcs");
+    check(vmptrld(vmcs_address) == instruction_result_t::success, "vmptrld after vmclear");
+    check(vmread(field_t::guest_rip, value) == instruction_result_t::success && value == 0x1000, "vmread after vmclear");
+    check(vmlaunch() == instruction_result_t::success, "vmlaunch after vmclear");
+
+    check(vmxoff() == instruction_result_t::success, "vmxoff");
+}
+
+static void bench_fields() {
+    const auto vmxon_address = reinterpret_cast<physical_address_t>(&g_vmxon_region);
+    const auto vmcs_address = reinterpret_cast<physical_address_t>(&g_vmcs);
+    mock::reset();
+    vmxon(vmxon_address);
+    vmclear(vmcs_address);
+    vmptrld(vmcs_address);
+
+    uint64_t sum = 0;
+    const auto start = x86::tsc::read_ordered();
+    for (size_t i = 0; i < bench_iterations; ++i) {
+        uint64_t value;
+        vmwrite(field_t::guest_rip, i);
+        vmread(field_t::guest_rip, value);
+        sum += value;
+    }
+    const auto cycles = x86::tsc::read_ordered() - start;
+
+    const auto& stats = mock::stats();
+    check(stats.vmread == bench_iterations && stats.vmwrite == bench_iterations, "stats");
+    printf("vmwrite+vmread: %llu tsc cycles (%llu)\n",
+                static_cast<unsigned long long>(cycles / bench_iterations),
+                static_cast<unsigned long long>(sum));
+
+    vmxoff();
+}
+
+int main() {
+    test_instructions();
+    bench_fields();
+
+    if (g_failures != 0) {
+        printf("%d failures\n", g_failures);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}